@@ -18,6 +18,7 @@
  * Arduino driver library (source file) for the Decawave DW1000 UWB transceiver IC.
  */
 
+#include <stddef.h>
 #include "DW1000.h"
 
 DW1000Class DW1000;
@@ -38,6 +39,13 @@ void (*DW1000Class::_handleReceiveFailed)(void) = 0;
 void (*DW1000Class::_handleReceiveTimeout)(void) = 0;
 void (*DW1000Class::_handleReceiveTimestampAvailable)(void) = 0;
 
+// deferred interrupt processing
+boolean DW1000Class::_deferredInterrupts = false;
+volatile boolean DW1000Class::_interruptPending = false;
+volatile uint32_t DW1000Class::_interruptTime = 0;
+uint32_t DW1000Class::_interruptLatency = 0;
+uint32_t DW1000Class::_maxInterruptLatency = 0;
+
 // registers
 byte DW1000Class::_syscfg[LEN_SYS_CFG];
 byte DW1000Class::_sysctrl[LEN_SYS_CTRL];
@@ -50,6 +58,7 @@ byte DW1000Class::_networkAndAddress[LEN_PANADR];
 // monitoring
 byte DW1000Class::_vmeas3v3 = 0;
 byte DW1000Class::_tmeas23C = 0;
+byte DW1000Class::_xtalTrim = 0x10;
 
 // driver internal state
 byte DW1000Class::_extendedFrameLength = FRAME_LENGTH_NORMAL;
@@ -60,11 +69,13 @@ byte DW1000Class::_preambleLength = TX_PREAMBLE_LEN_128;
 byte DW1000Class::_preambleCode = PREAMBLE_CODE_16MHZ_4;
 byte DW1000Class::_channel = CHANNEL_5;
 DW1000Time DW1000Class::_antennaDelay;
+DW1000Time DW1000Class::_maxTurnaround;
 boolean DW1000Class::_antennaCalibrated = false;
 boolean DW1000Class::_smartPower = false;
 
 boolean DW1000Class::_frameCheck = true;
 boolean DW1000Class::_permanentReceive = false;
+boolean DW1000Class::_doubleBuffering = false;
 uint8_t DW1000Class::_deviceMode = IDLE_MODE; // TODO replace by enum
 
 boolean DW1000Class::_debounceClockEnabled = false;
@@ -97,6 +108,38 @@ const byte DW1000Class::BIAS_500_64[] = {110, 105, 100, 93, 82, 69, 51, 27, 0, 2
 const byte DW1000Class::BIAS_900_16[] = {137, 122, 105, 88, 69, 47, 25, 0, 21, 48, 79, 105, 127, 147, 160, 169, 178, 197};
 const byte DW1000Class::BIAS_900_64[] = {147, 133, 117, 99, 75, 50, 29, 0, 24, 45, 63, 76, 87, 98, 116, 122, 132, 142};
 */
+// precomputed tune() register images (values as in buildTuneImage(), little endian)
+#define TUNE_BYTES8(v) (byte)((v) & 0xFF)
+#define TUNE_BYTES16(v) TUNE_BYTES8(v), (byte)(((v) >> 8) & 0xFF)
+#define TUNE_BYTES32(v) TUNE_BYTES16(v), (byte)(((v) >> 16) & 0xFF), (byte)(((v) >> 24) & 0xFF)
+static constexpr DW1000Class::TuneImage TUNE_IMAGES[] = {
+	// MODE_LONGDATA_RANGE_LOWPOWER, channel 5, preamble code 4
+	{DW1000Class::TRX_RATE_110KBPS, DW1000Class::TX_PULSE_FREQ_16MHZ, DW1000Class::TX_PREAMBLE_LEN_2048,
+	 DW1000Class::CHANNEL_5, DW1000Class::PREAMBLE_CODE_16MHZ_4, false,
+	 {TUNE_BYTES16(0x8870)}, {TUNE_BYTES32(0x2502A907L)}, {TUNE_BYTES16(0x0035)},
+	 {TUNE_BYTES16(0x0016), TUNE_BYTES16(0x0087), TUNE_BYTES16(0x0064), TUNE_BYTES32(0x371A011DL)},
+	 {TUNE_BYTES16(0x0028)},
+	 {TUNE_BYTES8(0xD)}, {TUNE_BYTES16(0x1607)}, {TUNE_BYTES16((0x428E >> 3) & 0xFFFF)},
+	 {TUNE_BYTES32(0x48484848L)},
+	 {TUNE_BYTES8(0xD8), TUNE_BYTES32(0x001E3FE0L)},
+	 {TUNE_BYTES8(0xC0)},
+	 {TUNE_BYTES32(0x0800041DL), TUNE_BYTES8(0xBE)}},
+	// 6.8 Mb/s, 16 MHz PRF, 64 symbols preamble (MY_MODE of the pizzo00 examples), channel 5, preamble code 4
+	{DW1000Class::TRX_RATE_6800KBPS, DW1000Class::TX_PULSE_FREQ_16MHZ, DW1000Class::TX_PREAMBLE_LEN_64,
+	 DW1000Class::CHANNEL_5, DW1000Class::PREAMBLE_CODE_16MHZ_4, false,
+	 {TUNE_BYTES16(0x8870)}, {TUNE_BYTES32(0x2502A907L)}, {TUNE_BYTES16(0x0035)},
+	 {TUNE_BYTES16(0x0001), TUNE_BYTES16(0x0087), TUNE_BYTES16(0x0010), TUNE_BYTES32(0x311A002DL)},
+	 {TUNE_BYTES16(0x0010)},
+	 {TUNE_BYTES8(0xD)}, {TUNE_BYTES16(0x1607)}, {TUNE_BYTES16(0x428E)},
+	 {TUNE_BYTES32(0x48484848L)},
+	 {TUNE_BYTES8(0xD8), TUNE_BYTES32(0x001E3FE0L)},
+	 {TUNE_BYTES8(0xC0)},
+	 {TUNE_BYTES32(0x0800041DL), TUNE_BYTES8(0xBE)}},
+};
+#undef TUNE_BYTES32
+#undef TUNE_BYTES16
+#undef TUNE_BYTES8
+
 // SPI settings
 #ifdef ESP8266
 // default ESP8266 frequency is 80 Mhz, thus divide by 4 is 20 MHz
@@ -157,6 +200,9 @@ void DW1000Class::select(uint8_t ss)
 	_vmeas3v3 = buf_otp[0];
 	readBytesOTP(0x009, buf_otp); // the stored 23C reading
 	_tmeas23C = buf_otp[0];
+	// crystal calibration from OTP, no trim value available means midrange value of 0x10
+	readBytesOTP(0x01E, buf_otp);
+	_xtalTrim = (buf_otp[0] == 0) ? 0x10 : buf_otp[0];
 }
 
 void DW1000Class::reselect(uint8_t ss)
@@ -365,26 +411,84 @@ void DW1000Class::enableMode(const byte mode[])
 }
 
 void DW1000Class::tune()
+{
+	// precomputed register image for the common modes, generic tuning otherwise
+	const TuneImage *image = findTuneImage();
+	TuneImage generic;
+	if (image == nullptr)
+	{
+		buildTuneImage(generic);
+		image = &generic;
+	}
+#if DW1000_CHECK_TUNE_IMAGES
+	else
+	{
+		// TUNE_IMAGES is a copy of the branch code, which wins if they differ
+		buildTuneImage(generic);
+		if (memcmp(image->agctune1, generic.agctune1, sizeof(TuneImage) - offsetof(TuneImage, agctune1)) != 0)
+			image = &generic;
+	}
+#endif
+	writeTuneImage(*image);
+}
+
+const DW1000Class::TuneImage *DW1000Class::findTuneImage()
+{
+	for (uint8_t i = 0; i < sizeof(TUNE_IMAGES) / sizeof(TUNE_IMAGES[0]); i++)
+	{
+		const TuneImage &image = TUNE_IMAGES[i];
+		if (image.dataRate == _dataRate && image.pulseFrequency == _pulseFrequency &&
+			image.preambleLength == _preambleLength && image.channel == _channel &&
+			image.preambleCode == _preambleCode && image.smartPower == _smartPower)
+		{
+			return &image;
+		}
+	}
+	return nullptr;
+}
+
+void DW1000Class::writeTuneImage(const TuneImage &image)
+{
+	// DRX_TUNE0b..DRX_TUNE2, RF_RXCTRLH/RF_TXCTRL and FS_PLLCFG/FS_PLLTUNE are
+	// adjacent sub-registers, so each group goes out as a single burst
+	writeBytes(AGC_TUNE, AGC_TUNE1_SUB, (byte *)image.agctune1, LEN_AGC_TUNE1);
+	writeBytes(AGC_TUNE, AGC_TUNE2_SUB, (byte *)image.agctune2, LEN_AGC_TUNE2);
+	writeBytes(AGC_TUNE, AGC_TUNE3_SUB, (byte *)image.agctune3, LEN_AGC_TUNE3);
+	writeBytes(DRX_TUNE, DRX_TUNE0b_SUB, (byte *)image.drxtune, sizeof(image.drxtune));
+	writeBytes(DRX_TUNE, DRX_TUNE4H_SUB, (byte *)image.drxtune4H, LEN_DRX_TUNE4H);
+	writeBytes(LDE_IF, LDE_CFG1_SUB, (byte *)image.ldecfg1, LEN_LDE_CFG1);
+	writeBytes(LDE_IF, LDE_CFG2_SUB, (byte *)image.ldecfg2, LEN_LDE_CFG2);
+	writeBytes(LDE_IF, LDE_REPC_SUB, (byte *)image.lderepc, LEN_LDE_REPC);
+	writeBytes(TX_POWER, NO_SUB, (byte *)image.txpower, LEN_TX_POWER);
+	writeBytes(RF_CONF, RF_RXCTRLH_SUB, (byte *)image.rfconf, sizeof(image.rfconf));
+	writeBytes(TX_CAL, TC_PGDELAY_SUB, (byte *)image.tcpgdelay, LEN_TC_PGDELAY);
+	writeBytes(FS_CTRL, FS_PLLCFG_SUB, (byte *)image.fspll, sizeof(image.fspll));
+	// crystal trim is board specific, read once from OTP in select()
+	byte fsxtalt = (_xtalTrim & 0x1F) | 0x60;
+	writeBytes(FS_CTRL, FS_XTALT_SUB, &fsxtalt, LEN_FS_XTALT);
+}
+
+void DW1000Class::buildTuneImage(TuneImage &image)
 {
 	// these registers are going to be tuned/configured
-	byte agctune1[LEN_AGC_TUNE1];
-	byte agctune2[LEN_AGC_TUNE2];
-	byte agctune3[LEN_AGC_TUNE3];
-	byte drxtune0b[LEN_DRX_TUNE0b];
-	byte drxtune1a[LEN_DRX_TUNE1a];
-	byte drxtune1b[LEN_DRX_TUNE1b];
-	byte drxtune2[LEN_DRX_TUNE2];
-	byte drxtune4H[LEN_DRX_TUNE4H];
-	byte ldecfg1[LEN_LDE_CFG1];
-	byte ldecfg2[LEN_LDE_CFG2];
-	byte lderepc[LEN_LDE_REPC];
-	byte txpower[LEN_TX_POWER];
-	byte rfrxctrlh[LEN_RF_RXCTRLH];
-	byte rftxctrl[LEN_RF_TXCTRL];
-	byte tcpgdelay[LEN_TC_PGDELAY];
-	byte fspllcfg[LEN_FS_PLLCFG];
-	byte fsplltune[LEN_FS_PLLTUNE];
-	byte fsxtalt[LEN_FS_XTALT];
+	byte *agctune1 = image.agctune1;
+	byte *agctune2 = image.agctune2;
+	byte *agctune3 = image.agctune3;
+	byte *drxtune0b = image.drxtune;
+	byte *drxtune1a = drxtune0b + LEN_DRX_TUNE0b;
+	byte *drxtune1b = drxtune1a + LEN_DRX_TUNE1a;
+	byte *drxtune2 = drxtune1b + LEN_DRX_TUNE1b;
+	byte *drxtune4H = image.drxtune4H;
+	byte *ldecfg1 = image.ldecfg1;
+	byte *ldecfg2 = image.ldecfg2;
+	byte *lderepc = image.lderepc;
+	byte *txpower = image.txpower;
+	byte *rfrxctrlh = image.rfconf;
+	byte *rftxctrl = rfrxctrlh + LEN_RF_RXCTRLH;
+	byte *tcpgdelay = image.tcpgdelay;
+	byte *fspllcfg = image.fspll;
+	byte *fsplltune = fspllcfg + LEN_FS_PLLCFG;
+	memset(&image, 0, sizeof(TuneImage));
 	// AGC_TUNE1
 	if (_pulseFrequency == TX_PULSE_FREQ_16MHZ)
 	{
@@ -935,44 +1039,44 @@ void DW1000Class::tune()
 	{
 		// TODO proper error/warning handling
 	}
-	// Crystal calibration from OTP (if available)
-	byte buf_otp[4];
-	readBytesOTP(0x01E, buf_otp);
-	if (buf_otp[0] == 0)
-	{
-		// No trim value available from OTP, use midrange value of 0x10
-		writeValueToBytes(fsxtalt, ((0x10 & 0x1F) | 0x60), LEN_FS_XTALT);
-	}
-	else
-	{
-		writeValueToBytes(fsxtalt, ((buf_otp[0] & 0x1F) | 0x60), LEN_FS_XTALT);
-	}
-	// write configuration back to chip
-	writeBytes(AGC_TUNE, AGC_TUNE1_SUB, agctune1, LEN_AGC_TUNE1);
-	writeBytes(AGC_TUNE, AGC_TUNE2_SUB, agctune2, LEN_AGC_TUNE2);
-	writeBytes(AGC_TUNE, AGC_TUNE3_SUB, agctune3, LEN_AGC_TUNE3);
-	writeBytes(DRX_TUNE, DRX_TUNE0b_SUB, drxtune0b, LEN_DRX_TUNE0b);
-	writeBytes(DRX_TUNE, DRX_TUNE1a_SUB, drxtune1a, LEN_DRX_TUNE1a);
-	writeBytes(DRX_TUNE, DRX_TUNE1b_SUB, drxtune1b, LEN_DRX_TUNE1b);
-	writeBytes(DRX_TUNE, DRX_TUNE2_SUB, drxtune2, LEN_DRX_TUNE2);
-	writeBytes(DRX_TUNE, DRX_TUNE4H_SUB, drxtune4H, LEN_DRX_TUNE4H);
-	writeBytes(LDE_IF, LDE_CFG1_SUB, ldecfg1, LEN_LDE_CFG1);
-	writeBytes(LDE_IF, LDE_CFG2_SUB, ldecfg2, LEN_LDE_CFG2);
-	writeBytes(LDE_IF, LDE_REPC_SUB, lderepc, LEN_LDE_REPC);
-	writeBytes(TX_POWER, NO_SUB, txpower, LEN_TX_POWER);
-	writeBytes(RF_CONF, RF_RXCTRLH_SUB, rfrxctrlh, LEN_RF_RXCTRLH);
-	writeBytes(RF_CONF, RF_TXCTRL_SUB, rftxctrl, LEN_RF_TXCTRL);
-	writeBytes(TX_CAL, TC_PGDELAY_SUB, tcpgdelay, LEN_TC_PGDELAY);
-	writeBytes(FS_CTRL, FS_PLLTUNE_SUB, fsplltune, LEN_FS_PLLTUNE);
-	writeBytes(FS_CTRL, FS_PLLCFG_SUB, fspllcfg, LEN_FS_PLLCFG);
-	writeBytes(FS_CTRL, FS_XTALT_SUB, fsxtalt, LEN_FS_XTALT);
 }
 
 /* ###########################################################################
  * #### Interrupt handling ###################################################
  * ######################################################################### */
 
-void DW1000Class::handleInterrupt()
+void DW1000_IRAM_ATTR DW1000Class::handleInterrupt()
+{
+	if (!_deferredInterrupts)
+	{
+		serviceInterrupt();
+		return;
+	}
+	// only latch the event, the SPI work is done by processInterrupts()
+	if (!_interruptPending)
+	{
+		_interruptTime = micros();
+		_interruptPending = true;
+	}
+}
+
+void DW1000Class::processInterrupts()
+{
+	if (!_interruptPending)
+	{
+		return;
+	}
+	// clear the flag first, an edge during servicing is handled on the next call
+	_interruptPending = false;
+	_interruptLatency = micros() - _interruptTime;
+	if (_interruptLatency > _maxInterruptLatency)
+	{
+		_maxInterruptLatency = _interruptLatency;
+	}
+	serviceInterrupt();
+}
+
+void DW1000Class::serviceInterrupt()
 {
 	// read current status and handle via callbacks
 	readSystemEventStatusRegister();
@@ -990,40 +1094,92 @@ void DW1000Class::handleInterrupt()
 		(*_handleReceiveTimestampAvailable)();
 		clearReceiveTimestampAvailableStatus();
 	}
-	if (isReceiveFailed() && _handleReceiveFailed != 0)
+	// the frame wait timeout may be newer than a frame still waiting to be read, which is handled first
+	boolean receiveTimeout = isReceiveTimeout();
+	if (isReceiveDone() && _handleReceived != 0)
+	{
+		if (_doubleBuffering)
+		{
+			serviceDoubleBufferedReceive();
+		}
+		else
+		{
+			(*_handleReceived)();
+			clearReceiveStatus();
+			if (_permanentReceive && !receiveTimeout)
+			{
+				newReceive();
+				startReceive();
+			}
+		}
+	}
+	else if (isReceiveFailed() && _handleReceiveFailed != 0)
 	{
 		(*_handleReceiveFailed)();
 		clearReceiveStatus();
-		if (_permanentReceive)
+		if (_doubleBuffering)
+		{
+			// the receiver is still on (RXAUTR) and may be filling the other buffer, an idle would
+			// abort that frame: only hand the host side buffer back to the chip
+			syncReceiveBuffers();
+		}
+		else if (_permanentReceive && !receiveTimeout)
 		{
 			newReceive();
 			startReceive();
 		}
 	}
-	else if (isReceiveTimeout() && _handleReceiveTimeout != 0)
+	if (receiveTimeout && _handleReceiveTimeout != 0)
 	{
 		(*_handleReceiveTimeout)();
-		clearReceiveStatus();
+		clearReceiveTimeoutStatus();
+		// the frame wait timeout turned the receiver off, a pending frame keeps its buffer
 		if (_permanentReceive)
 		{
 			newReceive();
 			startReceive();
 		}
 	}
-	else if (isReceiveDone() && _handleReceived != 0)
+	if (_doubleBuffering)
 	{
-		(*_handleReceived)();
-		clearReceiveStatus();
-		if (_permanentReceive)
+		// keep the events of a frame that meanwhile arrived in the other buffer,
+		// the IRQ line stays high for it so it has to be serviced on the next call
+		clearAllStatusExceptReceive();
+		readSystemEventStatusRegister();
+		if (isReceiveDone())
 		{
-			newReceive();
-			startReceive();
+			_interruptPending = true;
 		}
+		return;
 	}
 	// clear all status that is left unhandled
 	clearAllStatus();
 }
 
+void DW1000Class::serviceDoubleBufferedReceive()
+{
+	// at most both buffers can be full, the status always refers to the host side one
+	for (uint8_t i = 0; i < 2 && isReceiveDone(); i++)
+	{
+		if (isReceiveOverrun())
+		{
+			// a frame arrived while both buffers were full, their content is not reliable
+			// anymore: the receiver restarts with both of them handed back to the chip
+			idle();
+			clearReceiveStatus();
+			syncReceiveBuffers();
+			newReceive();
+			startReceive();
+			return;
+		}
+		(*_handleReceived)();
+		clearReceiveStatus();
+		// hand the buffer back to the chip and look at the other one
+		toggleReceiveBuffer();
+		readSystemEventStatusRegister();
+	}
+}
+
 /* ###########################################################################
  * #### Pretty printed device information ####################################
  * ######################################################################### */
@@ -1310,9 +1466,35 @@ void DW1000Class::setFrameFilterAllowReserved(boolean val)
 
 void DW1000Class::setDoubleBuffering(boolean val)
 {
+	_doubleBuffering = val;
 	setBit(_syscfg, LEN_SYS_CFG, DIS_DRXB_BIT, !val);
 }
 
+void DW1000Class::toggleReceiveBuffer()
+{
+	// HRBPT is the only bit in the last byte of SYS_CTRL
+	byte sysctrl3 = 0x01 << (HRBPT_BIT - 24);
+	writeBytes(SYS_CTRL, 0x03, &sysctrl3, 1);
+}
+
+boolean DW1000Class::isReceiveBufferPending()
+{
+	byte status1;
+	readBytes(SYS_STATUS, 0x01, &status1, 1);
+	return (status1 >> ((_frameCheck ? RXFCG_BIT : RXDFR_BIT) - 8)) & 0x01;
+}
+
+void DW1000Class::syncReceiveBuffers()
+{
+	// the host side and the IC side buffer pointers have to be equal before receiving
+	byte status3;
+	readBytes(SYS_STATUS, 0x03, &status3, 1);
+	if (((status3 >> (HSRBP_BIT - 24)) & 0x01) != ((status3 >> (ICRBP_BIT - 24)) & 0x01))
+	{
+		toggleReceiveBuffer();
+	}
+}
+
 void DW1000Class::setInterruptPolarity(boolean val)
 {
 	setBit(_syscfg, LEN_SYS_CFG, HIRQ_POL_BIT, val);
@@ -1323,6 +1505,20 @@ void DW1000Class::setReceiverAutoReenable(boolean val)
 	setBit(_syscfg, LEN_SYS_CFG, RXAUTR_BIT, val);
 }
 
+void DW1000Class::setReceiveFrameWaitTimeout(uint32_t timeoutUs)
+{
+	if (timeoutUs > 0)
+	{
+		// one unit is 512 periods of the 499.2 MHz clock
+		uint32_t units = (uint32_t)(timeoutUs * 0.975f) + 1;
+		byte fwto[LEN_RX_FWTO];
+		writeValueToBytes(fwto, units > 0xFFFF ? 0xFFFF : units, LEN_RX_FWTO);
+		writeBytes(RX_FWTO, NO_SUB, fwto, LEN_RX_FWTO);
+	}
+	setBit(_syscfg, LEN_SYS_CFG, RXWTOE_BIT, timeoutUs > 0);
+	writeSystemConfigurationRegister();
+}
+
 void DW1000Class::interruptOnSent(boolean val)
 {
 	setBit(_sysmask, LEN_SYS_MASK, TXFRS_BIT, val);
@@ -1391,12 +1587,29 @@ void DW1000Class::newReceive()
 {
 	idle();
 	memset(_sysctrl, 0, LEN_SYS_CTRL);
-	clearReceiveStatus();
+	// with double buffering a frame the host has not read yet keeps its status
+	if (!_doubleBuffering || !isReceiveBufferPending())
+	{
+		clearReceiveStatus();
+	}
 	_deviceMode = RX_MODE;
 }
 
 void DW1000Class::startReceive()
 {
+	if (_doubleBuffering)
+	{
+		if (isReceiveBufferPending())
+		{
+			// the chip receives into the other buffer, this one is serviced by the next processInterrupts()
+			_interruptPending = true;
+		}
+		else
+		{
+			// both buffers free, the pointers can be realigned without losing a frame
+			syncReceiveBuffers();
+		}
+	}
 	setBit(_sysctrl, LEN_SYS_CTRL, SFCST_BIT, !_frameCheck);
 	setBit(_sysctrl, LEN_SYS_CTRL, RXENAB_BIT, true);
 	writeBytes(SYS_CTRL, NO_SUB, _sysctrl, LEN_SYS_CTRL);
@@ -1478,6 +1691,133 @@ void DW1000Class::useSmartPower(boolean smartPower)
 }
 
 DW1000Time DW1000Class::setDelay(const DW1000Time &delay)
+{
+	if (!enableDelay())
+	{
+		// in idle, ignore
+		return DW1000Time();
+	}
+	DW1000Time futureTime;
+	getSystemTimestamp(futureTime);
+	futureTime += delay;
+	return writeDelayedTime(futureTime);
+}
+
+boolean DW1000Class::setDelayFrom(const DW1000Time &reference, const DW1000Time &delay, DW1000Time &futureTime)
+{
+	if (_deviceMode != TX_MODE && _deviceMode != RX_MODE)
+	{
+		// in idle, ignore
+		return false;
+	}
+	// processing time since the reference, on the chip clock
+	DW1000Time now;
+	getSystemTimestamp(now);
+	DW1000Time turnaround = (now - reference).wrap();
+	if (turnaround.getTimestamp() > _maxTurnaround.getTimestamp())
+	{
+		_maxTurnaround = turnaround;
+	}
+	// the transmitter needs the preamble duration before the scheduled time
+	turnaround += DW1000Time(DELAYED_TX_GUARD_US);
+	if (_deviceMode == TX_MODE)
+	{
+		turnaround += getPreambleTime();
+	}
+	if (turnaround.getTimestamp() >= delay.getTimestamp())
+	{
+		// too late, the chip would only transmit after the 17 s counter wrap
+		return false;
+	}
+	enableDelay();
+	futureTime = writeDelayedTime(reference + delay);
+	return true;
+}
+
+boolean DW1000Class::setDelayAt(const DW1000Time &time, DW1000Time &futureTime)
+{
+	if (_deviceMode != TX_MODE && _deviceMode != RX_MODE)
+	{
+		// in idle, ignore
+		return false;
+	}
+	DW1000Time now;
+	getSystemTimestamp(now);
+	DW1000Time lead = (time - now).wrap();
+	DW1000Time minimumLead = DW1000Time(DELAYED_TX_GUARD_US);
+	if (_deviceMode == TX_MODE)
+	{
+		minimumLead += getPreambleTime();
+	}
+	// more than half the counter range ahead means the time has already passed
+	if (lead.getTimestamp() < minimumLead.getTimestamp() || lead.getTimestamp() > DW1000Time::TIME_OVERFLOW / 2)
+	{
+		return false;
+	}
+	enableDelay();
+	futureTime = writeDelayedTime(time);
+	return true;
+}
+
+DW1000Time DW1000Class::getMinimumTurnaroundTime()
+{
+	return _maxTurnaround + DW1000Time(DELAYED_TX_GUARD_US) + getPreambleTime();
+}
+
+DW1000Time DW1000Class::getPreambleTime()
+{
+	uint16_t symbols;
+	if (_preambleLength == TX_PREAMBLE_LEN_64)
+	{
+		symbols = 64;
+	}
+	else if (_preambleLength == TX_PREAMBLE_LEN_128)
+	{
+		symbols = 128;
+	}
+	else if (_preambleLength == TX_PREAMBLE_LEN_256)
+	{
+		symbols = 256;
+	}
+	else if (_preambleLength == TX_PREAMBLE_LEN_512)
+	{
+		symbols = 512;
+	}
+	else if (_preambleLength == TX_PREAMBLE_LEN_1024)
+	{
+		symbols = 1024;
+	}
+	else if (_preambleLength == TX_PREAMBLE_LEN_1536)
+	{
+		symbols = 1536;
+	}
+	else if (_preambleLength == TX_PREAMBLE_LEN_2048)
+	{
+		symbols = 2048;
+	}
+	else
+	{
+		symbols = 4096;
+	}
+	// SFD length as written by setDataRate()
+	if (_dataRate == TRX_RATE_110KBPS)
+	{
+		symbols += 64;
+	}
+	else if (_dataRate == TRX_RATE_850KBPS)
+	{
+		symbols += 16;
+	}
+	else
+	{
+		symbols += 8;
+	}
+	// preamble symbol duration: 993.59 ns at 16 MHz PRF, 1017.63 ns at 64 MHz PRF
+	float symbolUs = (_pulseFrequency == TX_PULSE_FREQ_16MHZ) ? 0.99359f : 1.01763f;
+	return DW1000Time(symbols * symbolUs);
+}
+
+boolean DW1000Class::enableDelay()
 {
 	if (_deviceMode == TX_MODE)
 	{
@@ -1489,14 +1829,16 @@ DW1000Time DW1000Class::setDelay(const DW1000Time &delay)
 	}
 	else
 	{
-		// in idle, ignore
-		return DW1000Time();
+		return false;
 	}
+	return true;
+}
+
+DW1000Time DW1000Class::writeDelayedTime(const DW1000Time &time)
+{
 	byte delayBytes[5];
 	DW1000Time futureTime;
-	getSystemTimestamp(futureTime);
-	futureTime += delay;
-	futureTime.getTimestamp(delayBytes);
+	time.getTimestamp(delayBytes);
 	delayBytes[0] = 0;
 	delayBytes[1] &= 0xFE;
 	writeBytes(DX_TIME, NO_SUB, delayBytes, LEN_DX_TIME);
@@ -1949,7 +2291,13 @@ boolean DW1000Class::isReceiveFailed()
 // Checks to see any of the three timeout bits in sysstatus are high (RXRFTO (Frame Wait timeout), RXPTO (Preamble timeout), RXSFDTO (Start frame delimiter(?) timeout).
 boolean DW1000Class::isReceiveTimeout()
 {
-	return (getBit(_sysstatus, LEN_SYS_STATUS, RXRFTO_BIT) | getBit(_sysstatus, LEN_SYS_STATUS, RXPTO_BIT) | getBit(_sysstatus, LEN_SYS_STATUS, RXSFDTO_BIT));
+	// the frame wait timeout only: preamble and SFD timeouts are noise, the receiver re-enables itself (RXAUTR)
+	return getBit(_sysstatus, LEN_SYS_STATUS, RXRFTO_BIT);
+}
+
+boolean DW1000Class::isReceiveOverrun()
+{
+	return getBit(_sysstatus, LEN_SYS_STATUS, RXOVRR_BIT);
 }
 
 boolean DW1000Class::isClockProblem()
@@ -1971,6 +2319,19 @@ void DW1000Class::clearAllStatus()
 	writeBytes(SYS_STATUS, NO_SUB, _sysstatus, LEN_SYS_STATUS);
 }
 
+void DW1000Class::clearAllStatusExceptReceive()
+{
+	// like clearAllStatus(), but the good frame events (preamble to FCS good) are kept
+	memset(_sysstatus, 0xff, LEN_SYS_STATUS);
+	setBit(_sysstatus, LEN_SYS_STATUS, RXPRD_BIT, false);
+	setBit(_sysstatus, LEN_SYS_STATUS, RXSFDD_BIT, false);
+	setBit(_sysstatus, LEN_SYS_STATUS, LDEDONE_BIT, false);
+	setBit(_sysstatus, LEN_SYS_STATUS, RXPHD_BIT, false);
+	setBit(_sysstatus, LEN_SYS_STATUS, RXDFR_BIT, false);
+	setBit(_sysstatus, LEN_SYS_STATUS, RXFCG_BIT, false);
+	writeBytes(SYS_STATUS, NO_SUB, _sysstatus, LEN_SYS_STATUS);
+}
+
 void DW1000Class::clearReceiveTimestampAvailableStatus()
 {
 	setBit(_sysstatus, LEN_SYS_STATUS, LDEDONE_BIT, true);
@@ -1990,6 +2351,15 @@ void DW1000Class::clearReceiveStatus()
 	writeBytes(SYS_STATUS, NO_SUB, _sysstatus, LEN_SYS_STATUS);
 }
 
+void DW1000Class::clearReceiveTimeoutStatus()
+{
+	// RXRFTO only, the other events may belong to a frame still to be read
+	byte status[LEN_SYS_STATUS];
+	memset(status, 0, LEN_SYS_STATUS);
+	setBit(status, LEN_SYS_STATUS, RXRFTO_BIT, true);
+	writeBytes(SYS_STATUS, NO_SUB, status, LEN_SYS_STATUS);
+}
+
 void DW1000Class::clearTransmitStatus()
 {
 	// clear latched TX bits
@@ -2012,6 +2382,39 @@ float DW1000Class::getReceiveQuality()
 	return (float)f2 / noise;
 }
 
+float DW1000Class::getClockOffset()
+{
+	byte carrierIntegratorBytes[LEN_DRX_CAR_INT];
+	readBytes(DRX_TUNE, DRX_CAR_INT_SUB, carrierIntegratorBytes, LEN_DRX_CAR_INT);
+	int32_t carrierIntegrator = (int32_t)carrierIntegratorBytes[0] | ((int32_t)carrierIntegratorBytes[1] << 8) |
+								((int32_t)(carrierIntegratorBytes[2] & 0x1F) << 16);
+	if (carrierIntegrator & 0x100000)
+	{
+		carrierIntegrator -= 0x200000;
+	}
+	// carrier frequency offset [Hz], see the DRX_CAR_INT description in the user manual
+	float offsetHz = carrierIntegrator * (998.4e6f / 2.0f / 131072.0f / (_dataRate == TRX_RATE_110KBPS ? 8192.0f : 1024.0f));
+	float carrierHz;
+	switch (_channel)
+	{
+	case CHANNEL_1:
+		carrierHz = 3494.4e6f;
+		break;
+	case CHANNEL_3:
+		carrierHz = 4492.8e6f;
+		break;
+	case CHANNEL_2:
+	case CHANNEL_4:
+		carrierHz = 3993.6e6f;
+		break;
+	default:
+		carrierHz = 6489.6e6f;
+		break;
+	}
+	// a positive integrator means a slower transmitter
+	return -offsetHz / carrierHz;
+}
+
 float DW1000Class::getFirstPathPower()
 {
 	byte fpAmpl1Bytes[LEN_FP_AMPL1];
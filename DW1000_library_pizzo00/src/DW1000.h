@@ -22,7 +22,6 @@
  * - TXBOFFS in TX_FCTRL for offset buffer transmit
  * - TR in TX_FCTRL for flagging for ranging messages
  * - CANSFCS in SYS_CTRL to cancel frame check suppression
- * - HSRBP in SYS_CTRL to determine in double buffered mode from which buffer to read
  */
 
 #ifndef _DW1000_H_INCLUDED
@@ -182,6 +181,19 @@ public:
 	*/
 	static void setReceiverAutoReenable(boolean val);
 	
+	/**
+	Sets the receive frame wait timeout. The timer starts when the receiver is enabled and raises a
+	receive timeout event (see `interruptOnReceiveTimeout()`) if no good frame came in meanwhile,
+	the receiver is then turned off by the chip.
+
+	Unlike the other configuration setters this is written to the chip immediately. Best called while
+	the receiver is off (e.g. between `newReceive()` and `startReceive()`), with the receiver on the
+	period is taken by the timer when it starts again (e.g. on the automatic re-enable, RXAUTR).
+
+	@param[in] timeoutUs The timeout in microseconds (up to about 67 ms), 0 disables it.
+	*/
+	static void setReceiveFrameWaitTimeout(uint32_t timeoutUs);
+	
 	/** 
 	Specifies the interrupt polarity of the DW1000 chip. 
 
@@ -241,6 +253,26 @@ public:
 	
 	/* transmit and receive configuration. */
 	static DW1000Time   setDelay(const DW1000Time& delay);
+	/**
+	Delays the next transmission (or reception) to `reference + delay`, where `reference` is a chip
+	timestamp, usually the RX timestamp of the frame that is answered. Unlike `setDelay()` the MCU
+	processing time since that frame is not added to the reply time. The processing time is measured
+	on every call, see `getMinimumTurnaroundTime()`.
+
+	@param[in] reference The chip timestamp the delay is relative to.
+	@param[in] delay The delay after `reference`.
+	@param[out] futureTime The expected transmit timestamp (antenna delay included).
+	@return `false` if the scheduled time cannot be met anymore (nothing is written in this case).
+	*/
+	static boolean      setDelayFrom(const DW1000Time& reference, const DW1000Time& delay, DW1000Time& futureTime);
+	// like setDelayFrom() for an absolute chip time (e.g. a TDMA slot), no processing time is measured
+	static boolean      setDelayAt(const DW1000Time& time, DW1000Time& futureTime);
+	// shortest delay after a RX timestamp that setDelayFrom() can still meet, based on the
+	// longest processing time measured so far and the preamble duration of the current mode
+	static DW1000Time   getMinimumTurnaroundTime();
+	static void         resetTurnaroundTime() { _maxTurnaround.setTimestamp((int64_t)0); }
+	// preamble and SFD duration of the current mode, the transmitter starts that much before the RMARKER
+	static DW1000Time   getPreambleTime();
 	static void         receivePermanently(boolean val);
 	static void         setData(byte data[], uint16_t n);
 	static void         setData(const String& data);
@@ -258,6 +290,9 @@ public:
 	static float getReceivePower();
 	static float getFirstPathPower();
 	static float getReceiveQuality();
+	// clock offset of the transmitter of the last frame relative to ours (remote rate / local rate - 1)
+	// from the carrier integrator
+	static float getClockOffset();
 	
 	/* interrupt management. */
 	static void interruptOnSent(boolean val);
@@ -295,6 +330,30 @@ public:
 	static void attachReceiveTimestampAvailableHandler(void (* handleReceiveTimestampAvailable)(void)) {
 		_handleReceiveTimestampAvailable = handleReceiveTimestampAvailable;
 	}
+
+	/* deferred interrupt processing. */
+	/**
+	When enabled the IRQ handler only latches the event, no SPI traffic happens in interrupt context.
+	Reading and clearing SYS_STATUS, the callbacks and the receiver re-arm are then done by
+	`processInterrupts()`.
+	Disabled by default, the chip is serviced inside the IRQ handler. DW1000Ranging enables it.
+
+	@param[in] val `true` to defer the interrupt processing, `false` to service in the IRQ handler.
+	*/
+	static void useDeferredInterrupts(boolean val) { _deferredInterrupts = val; }
+	/**
+	Services a pending DW1000 interrupt: reads and clears SYS_STATUS, calls the attached
+	handlers and re-arms the receiver in permanent receive mode. With deferred interrupts this
+	has to be called from the task that does all the other DW1000 calls (`DW1000Ranging.loop()`
+	does), the SPI accesses are not locked. The latency is only measured: it is bounded by the
+	time between two loop() calls, user callbacks (e.g. Serial prints) included.
+	*/
+	static void processInterrupts();
+	static boolean isInterruptPending() { return _interruptPending; }
+	// time between the IRQ edge and its processing [us]
+	static uint32_t getInterruptLatency() { return _interruptLatency; }
+	static uint32_t getMaxInterruptLatency() { return _maxInterruptLatency; }
+	static void resetInterruptLatency() { _maxInterruptLatency = 0; }
 	
 	/* device state management. */
 	// idle state
@@ -445,6 +504,8 @@ public:
 	/* device status monitoring */
 	static byte _vmeas3v3;
 	static byte _tmeas23C;
+	/* crystal trim from OTP */
+	static byte _xtalTrim;
 
 	/* PAN and short address. */
 	static byte _networkAndAddress[LEN_PANADR];
@@ -461,9 +522,13 @@ public:
 	static DW1000Time _antennaDelay;
 	static boolean    _antennaCalibrated;
 	
+	/* longest processing time measured by setDelayFrom() */
+	static DW1000Time _maxTurnaround;
+	
 	/* internal helper to remember how to properly act. */
 	static boolean _permanentReceive;
 	static boolean _frameCheck;
+	static boolean _doubleBuffering;
 	
 	// whether RX or TX is active
 	static uint8_t _deviceMode;
@@ -473,6 +538,14 @@ public:
 
 	/* Arduino interrupt handler */
 	static void handleInterrupt();
+	static void serviceInterrupt();
+	
+	/* deferred interrupt state */
+	static boolean           _deferredInterrupts;
+	static volatile boolean  _interruptPending;
+	static volatile uint32_t _interruptTime;
+	static uint32_t          _interruptLatency;
+	static uint32_t          _maxInterruptLatency;
 	
 	/* Allow MAC frame filtering . */
 	// TODO auto-acknowledge
@@ -486,15 +559,47 @@ public:
 	//Reserved is used for the Blink message
 	static void setFrameFilterAllowReserved(boolean val);
 	
-	// note: not sure if going to be implemented for now
+	// with double buffering the chip keeps receiving into the other RX buffer while the host
+	// reads the current one; the received handler is called once per buffer (data, timestamp
+	// and diagnostics of that buffer are readable there) and the host side buffer is toggled after it
 	static void setDoubleBuffering(boolean val);
+	static void toggleReceiveBuffer();
+	static void syncReceiveBuffers();
+	// a frame the host has not read yet is in the host side buffer
+	static boolean isReceiveBufferPending();
+	static void serviceDoubleBufferedReceive();
 	// TODO is implemented, but needs testing
 	static void useExtendedFrameLength(boolean val);
 	// TODO is implemented, but needs testing
 	static void waitForResponse(boolean val);
 	
 	/* tuning according to mode. */
+	struct TuneImage {
+		// mode the image belongs to
+		byte    dataRate;
+		byte    pulseFrequency;
+		byte    preambleLength;
+		byte    channel;
+		byte    preambleCode;
+		boolean smartPower;
+		// register values, adjacent sub-registers are merged to be written in one burst
+		byte agctune1[LEN_AGC_TUNE1];
+		byte agctune2[LEN_AGC_TUNE2];
+		byte agctune3[LEN_AGC_TUNE3];
+		byte drxtune[LEN_DRX_TUNE0b + LEN_DRX_TUNE1a + LEN_DRX_TUNE1b + LEN_DRX_TUNE2];
+		byte drxtune4H[LEN_DRX_TUNE4H];
+		byte ldecfg1[LEN_LDE_CFG1];
+		byte ldecfg2[LEN_LDE_CFG2];
+		byte lderepc[LEN_LDE_REPC];
+		byte txpower[LEN_TX_POWER];
+		byte rfconf[LEN_RF_RXCTRLH + LEN_RF_TXCTRL];
+		byte tcpgdelay[LEN_TC_PGDELAY];
+		byte fspll[LEN_FS_PLLCFG + LEN_FS_PLLTUNE];
+	};
 	static void tune();
+	static const TuneImage* findTuneImage();
+	static void buildTuneImage(TuneImage& image);
+	static void writeTuneImage(const TuneImage& image);
 	
 	/* device status flags */
 	static boolean isReceiveTimestampAvailable();
@@ -502,12 +607,15 @@ public:
 	static boolean isReceiveDone();
 	static boolean isReceiveFailed();
 	static boolean isReceiveTimeout();
+	static boolean isReceiveOverrun();
 	static boolean isClockProblem();
 	
 	/* interrupt state handling */
 	static void clearInterrupts();
 	static void clearAllStatus();
+	static void clearAllStatusExceptReceive();
 	static void clearReceiveStatus();
+	static void clearReceiveTimeoutStatus();
 	static void clearReceiveTimestampAvailableStatus();
 	static void clearTransmitStatus();
 	
@@ -533,6 +641,12 @@ public:
 	/* timestamp correction. */
 	static void correctTimestamp(DW1000Time& timestamp);
 	
+	/* delayed transceive. */
+	static boolean    enableDelay();
+	static DW1000Time writeDelayedTime(const DW1000Time& futureTime);
+	// SPI time between scheduling and starting the transmission [us]
+	static constexpr float DELAYED_TX_GUARD_US = 150;
+	
 	/* reading and writing bytes from and to DW1000 module. */
 	static void readBytes(byte cmd, uint16_t offset, byte data[], uint16_t n);
 	static void readBytesOTP(uint16_t address, byte data[]);
@@ -0,0 +1,194 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file DW1000Calibration.cpp
+ * Least squares antenna delay calibration of several modules.
+ */
+
+#include "DW1000Calibration.h"
+
+DW1000Calibration::DW1000Calibration()
+{
+	setModuleCount(0);
+}
+
+void DW1000Calibration::setModuleCount(uint8_t count)
+{
+	_count = count < CALIBRATION_MAX_MODULES ? count : CALIBRATION_MAX_MODULES;
+	for (uint8_t i = 0; i < CALIBRATION_MAX_MODULES; i++)
+	{
+		_addresses[i] = 0;
+		_antennaDelays[i] = 16384;
+		_errors[i] = 0;
+		for (uint8_t j = 0; j < CALIBRATION_MAX_MODULES; j++)
+		{
+			_distances[i][j] = CALIBRATION_NO_RANGE;
+			_rangeSum[i][j] = 0;
+			_rangeCount[i][j] = 0;
+		}
+	}
+}
+
+void DW1000Calibration::setModule(uint8_t i, uint16_t address, uint16_t antennaDelay)
+{
+	if (i >= _count)
+		return;
+	_addresses[i] = address;
+	_antennaDelays[i] = antennaDelay;
+}
+
+int16_t DW1000Calibration::getModuleIndex(uint16_t address)
+{
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		if (_addresses[i] == address)
+			return i;
+	}
+	return -1;
+}
+
+void DW1000Calibration::setKnownDistance(uint8_t i, uint8_t j, float distance)
+{
+	if (i >= _count || j >= _count || i == j)
+		return;
+	_distances[i][j] = _distances[j][i] = distance;
+}
+
+void DW1000Calibration::setKnownPositions(const float positions[][3])
+{
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		for (uint8_t j = i + 1; j < _count; j++)
+		{
+			float d2 = 0;
+			for (uint8_t k = 0; k < 3; k++)
+				d2 += (positions[i][k] - positions[j][k]) * (positions[i][k] - positions[j][k]);
+			setKnownDistance(i, j, sqrtf(d2));
+		}
+	}
+}
+
+void DW1000Calibration::addRange(uint8_t i, uint8_t j, float range)
+{
+	if (i >= _count || j >= _count || i == j)
+		return;
+	_rangeSum[i][j] += range;
+	_rangeSum[j][i] += range;
+	_rangeCount[i][j]++;
+	_rangeCount[j][i]++;
+}
+
+boolean DW1000Calibration::solve()
+{
+	// normal equations G e = b: G_ii = pairs of i, G_ij = 1 for a pair, b_i = sum of its range errors
+	float G[CALIBRATION_MAX_MODULES][CALIBRATION_MAX_MODULES];
+	float b[CALIBRATION_MAX_MODULES];
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		b[i] = 0;
+		for (uint8_t j = 0; j < _count; j++)
+			G[i][j] = 0;
+		for (uint8_t j = 0; j < _count; j++)
+		{
+			if (j == i || _rangeCount[i][j] == 0 || _distances[i][j] < 0)
+				continue;
+			float rangeError = _rangeSum[i][j] / _rangeCount[i][j] - _distances[i][j];
+			b[i] += rangeError / DW1000Time::DISTANCE_OF_RADIO;
+			G[i][i] += 1;
+			G[i][j] = 1;
+		}
+	}
+
+	// Gaussian elimination with partial pivoting
+	for (uint8_t col = 0; col < _count; col++)
+	{
+		uint8_t pivot = col;
+		for (uint8_t row = col + 1; row < _count; row++)
+		{
+			if (fabsf(G[row][col]) > fabsf(G[pivot][col]))
+				pivot = row;
+		}
+		if (fabsf(G[pivot][col]) < 1e-6f)
+			return false; // not enough pairs
+		for (uint8_t k = 0; k < _count; k++)
+		{
+			float tmp = G[col][k];
+			G[col][k] = G[pivot][k];
+			G[pivot][k] = tmp;
+		}
+		float tmp = b[col];
+		b[col] = b[pivot];
+		b[pivot] = tmp;
+		for (uint8_t row = col + 1; row < _count; row++)
+		{
+			float factor = G[row][col] / G[col][col];
+			for (uint8_t k = col; k < _count; k++)
+				G[row][k] -= factor * G[col][k];
+			b[row] -= factor * b[col];
+		}
+	}
+	for (int8_t row = _count - 1; row >= 0; row--)
+	{
+		float sum = b[row];
+		for (uint8_t k = row + 1; k < _count; k++)
+			sum -= G[row][k] * _errors[k];
+		_errors[row] = sum / G[row][row];
+	}
+	return true;
+}
+
+uint16_t DW1000Calibration::getAntennaDelay(uint8_t i)
+{
+	// a longer range needs a longer antenna delay
+	return (uint16_t)(_antennaDelays[i] + lroundf(_errors[i]));
+}
+
+float DW1000Calibration::getPairResidual(uint8_t i, uint8_t j)
+{
+	if (_rangeCount[i][j] == 0 || _distances[i][j] < 0)
+		return 0;
+	return _rangeSum[i][j] / _rangeCount[i][j] - _distances[i][j] - (_errors[i] + _errors[j]) * DW1000Time::DISTANCE_OF_RADIO;
+}
+
+float DW1000Calibration::getModuleResidual(uint8_t i)
+{
+	float sum = 0;
+	uint8_t pairs = 0;
+	for (uint8_t j = 0; j < _count; j++)
+	{
+		if (j == i || _rangeCount[i][j] == 0 || _distances[i][j] < 0)
+			continue;
+		float residual = getPairResidual(i, j);
+		sum += residual * residual;
+		pairs++;
+	}
+	return pairs > 0 ? sqrtf(sum / pairs) : 0;
+}
+
+float DW1000Calibration::getResidual()
+{
+	float sum = 0;
+	uint16_t pairs = 0;
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		for (uint8_t j = i + 1; j < _count; j++)
+		{
+			if (_rangeCount[i][j] == 0 || _distances[i][j] < 0)
+				continue;
+			float residual = getPairResidual(i, j);
+			sum += residual * residual;
+			pairs++;
+		}
+	}
+	return pairs > 0 ? sqrtf(sum / pairs) : 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file DW1000Calibration.h
+ * Antenna delays of all the modules at once from the ranges between modules at known
+ * distances, see DW1000Ranging::transmitAntennaDelays() to push them.
+ */
+
+#ifndef _DW1000Calibration_H_INCLUDED
+#define _DW1000Calibration_H_INCLUDED
+
+#include "DW1000Time.h"
+
+#define CALIBRATION_MAX_MODULES 12
+#define CALIBRATION_NO_RANGE -1.0f
+
+class DW1000Calibration
+{
+public:
+	DW1000Calibration();
+
+	// Modules by index, with the antenna delay they used during the ranging
+	void setModuleCount(uint8_t count);
+	uint8_t getModuleCount() { return _count; }
+	void setModule(uint8_t i, uint16_t address, uint16_t antennaDelay);
+	uint16_t getModuleAddress(uint8_t i) { return _addresses[i]; }
+	int16_t getModuleIndex(uint16_t address);
+
+	// True distance [m] of a pair, or of all pairs from the module coordinates
+	void setKnownDistance(uint8_t i, uint8_t j, float distance);
+	void setKnownPositions(const float positions[][3]);
+	// Measured range [m] of a pair, the ranges of a pair are averaged
+	void addRange(uint8_t i, uint8_t j, float range);
+
+	// Each module adds its delay error to the time of flight of every pair it is part of:
+	// range_ij - distance_ij = (e_i + e_j) * DISTANCE_OF_RADIO, solved for all e by least
+	// squares. Needs at least 3 modules and a pair graph with a cycle of odd length (a triangle).
+	boolean solve();
+	// Antenna delay to set on the module (DW1000.setAntennaDelay())
+	uint16_t getAntennaDelay(uint8_t i);
+	// Delay error [ticks] found for the module
+	float getDelayError(uint8_t i) { return _errors[i]; }
+
+	// Range [m] left unexplained after the correction, for a pair, rms of a module and overall
+	float getPairResidual(uint8_t i, uint8_t j);
+	float getModuleResidual(uint8_t i);
+	float getResidual();
+
+private:
+	uint8_t _count;
+	uint16_t _addresses[CALIBRATION_MAX_MODULES];
+	uint16_t _antennaDelays[CALIBRATION_MAX_MODULES];
+	float _distances[CALIBRATION_MAX_MODULES][CALIBRATION_MAX_MODULES];
+	float _rangeSum[CALIBRATION_MAX_MODULES][CALIBRATION_MAX_MODULES];
+	uint16_t _rangeCount[CALIBRATION_MAX_MODULES][CALIBRATION_MAX_MODULES];
+	float _errors[CALIBRATION_MAX_MODULES];
+};
+
+#endif
@@ -22,5 +22,29 @@
 #ifndef DW1000COMPILEOPTIONS_H
 #define DW1000COMPILEOPTIONS_H
 
+/**
+ * When true the ranging engine uses DW1000 extended frames (non standard PHR mode,
+ * up to 1023 bytes), so one POLL/RANGE round can serve up to 20 anchors instead of 6.
+ * All devices of a network must use the same setting.
+ */
+#define DW1000_EXTENDED_FRAMES false
+
+/**
+ * When true tune() also builds the register image with the branch code and uses it
+ * if the precomputed TUNE_IMAGES entry of the mode differs. For checking the table
+ * after a change of the tuning values.
+ */
+#define DW1000_CHECK_TUNE_IMAGES false
+
+/**
+ * Code running from the IRQ handler is placed in IRAM on ESP32 so it does not
+ * stall on flash cache misses.
+ */
+#ifdef ESP32
+#define DW1000_IRAM_ATTR IRAM_ATTR
+#else
+#define DW1000_IRAM_ATTR
+#endif
+
 
 #endif // DW1000COMPILEOPTIONS_H
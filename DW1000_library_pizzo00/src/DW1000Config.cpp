@@ -0,0 +1,127 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file DW1000Config.cpp
+ * Persistent node configuration.
+ */
+
+#include <stddef.h>
+#include "DW1000Config.h"
+
+#if defined(ESP32)
+#include <Preferences.h>
+#elif !defined(ARDUINO)
+#include <stdio.h>
+#endif
+
+DW1000Config::DW1000Config()
+{
+	_file = CONFIG_FILE;
+	clear();
+}
+
+void DW1000Config::clear()
+{
+	memset(&_record, 0, sizeof(_record));
+	_record.antennaDelay = 16384;
+	_record.dimensions = 3;
+}
+
+uint32_t DW1000Config::checksum(const DW1000ConfigRecord &record)
+{
+	// CRC-32 of everything before the checksum
+	const byte *data = reinterpret_cast<const byte *>(&record);
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < offsetof(DW1000ConfigRecord, checksum); i++)
+	{
+		crc ^= data[i];
+		for (uint8_t bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+	}
+	return ~crc;
+}
+
+boolean DW1000Config::load()
+{
+	DW1000ConfigRecord record;
+	size_t length = 0;
+#if defined(ESP32)
+	Preferences preferences;
+	if (!preferences.begin(CONFIG_NAMESPACE, true))
+		return false;
+	if (preferences.getBytesLength(CONFIG_KEY) == sizeof(record))
+		length = preferences.getBytes(CONFIG_KEY, &record, sizeof(record));
+	preferences.end();
+#elif !defined(ARDUINO)
+	FILE *file = fopen(_file, "rb");
+	if (file == NULL)
+		return false;
+	length = fread(&record, 1, sizeof(record), file);
+	fclose(file);
+#endif
+	if (length != sizeof(record) || record.magic != CONFIG_MAGIC || record.version != CONFIG_VERSION ||
+		record.checksum != checksum(record) || record.anchorCount > CONFIG_MAX_ANCHORS)
+		return false;
+	_record = record;
+	return true;
+}
+
+boolean DW1000Config::save()
+{
+	_record.magic = CONFIG_MAGIC;
+	_record.version = CONFIG_VERSION;
+	_record.checksum = checksum(_record);
+#if defined(ESP32)
+	Preferences preferences;
+	if (!preferences.begin(CONFIG_NAMESPACE, false))
+		return false;
+	size_t length = preferences.putBytes(CONFIG_KEY, &_record, sizeof(_record));
+	preferences.end();
+	return length == sizeof(_record);
+#elif !defined(ARDUINO)
+	FILE *file = fopen(_file, "wb");
+	if (file == NULL)
+		return false;
+	size_t length = fwrite(&_record, 1, sizeof(_record), file);
+	return fclose(file) == 0 && length == sizeof(_record);
+#else
+	return false; // no backend on this board
+#endif
+}
+
+boolean DW1000Config::setAnchors(const uint16_t addresses[], const float anchors[][3], uint8_t count, uint8_t dimensions)
+{
+	if (count > CONFIG_MAX_ANCHORS)
+		count = CONFIG_MAX_ANCHORS;
+	_record.anchorCount = count;
+	_record.dimensions = dimensions;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		_record.anchorAddresses[i] = addresses[i];
+		for (uint8_t k = 0; k < 3; k++)
+			_record.anchors[i][k] = anchors[i][k];
+	}
+
+	DW1000Tdoa solver;
+	_record.hasSolver = solver.setAnchors(_record.anchors, count, dimensions);
+	if (_record.hasSolver)
+		solver.getPseudoInverse(_record.pseudoInverse);
+	return _record.hasSolver;
+}
+
+boolean DW1000Config::loadSolver(DW1000Tdoa &solver)
+{
+	if (!_record.hasSolver)
+		return false;
+	return solver.setAnchors(_record.anchors, _record.anchorCount, _record.dimensions, _record.pseudoInverse);
+}
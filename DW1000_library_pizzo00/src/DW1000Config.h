@@ -0,0 +1,93 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file DW1000Config.h
+ * Persistent node configuration: antenna delay, address, mode, anchor coordinates and
+ * the solver matrices derived from them. Kept in NVS on ESP32, in a file on a host.
+ */
+
+#ifndef _DW1000Config_H_INCLUDED
+#define _DW1000Config_H_INCLUDED
+
+#include "DW1000Time.h"
+#include "DW1000Tdoa.h"
+
+#define CONFIG_MAGIC 0x4457
+// change on any change of DW1000ConfigRecord, older records are then ignored
+#define CONFIG_VERSION 1
+#define CONFIG_MAX_ANCHORS TDOA_MAX_ANCHORS
+// NVS namespace and key on ESP32, file on a host
+#define CONFIG_NAMESPACE "dw1000"
+#define CONFIG_KEY "config"
+#define CONFIG_FILE "dw1000.cfg"
+
+struct DW1000ConfigRecord
+{
+	uint16_t magic;
+	uint8_t version;
+	uint8_t boardType; // BoardType
+	uint16_t shortAddress;
+	uint16_t antennaDelay;
+	byte mode[3];
+	uint8_t dimensions;
+	uint8_t anchorCount;
+	boolean hasSolver;
+	uint16_t anchorAddresses[CONFIG_MAX_ANCHORS];
+	float anchors[CONFIG_MAX_ANCHORS][3];
+	// DW1000Tdoa::getPseudoInverse() of the anchors, valid if hasSolver
+	float pseudoInverse[3][CONFIG_MAX_ANCHORS - 1];
+	uint32_t checksum;
+};
+
+class DW1000Config
+{
+public:
+	// Defaults: 16384 antenna delay, no address, no mode, no anchors
+	DW1000Config();
+
+	// Read the record, it needs no radio so it can come before DW1000Ranging.init(). False
+	// (and the defaults kept) if there is none, or of another version, or corrupted
+	boolean load();
+	boolean save();
+	void clear();
+	// File of the host backend
+	void setFile(const char *file) { _file = file; }
+
+	void setBoardType(uint8_t boardType) { _record.boardType = boardType; }
+	uint8_t getBoardType() { return _record.boardType; }
+	void setShortAddress(uint16_t shortAddress) { _record.shortAddress = shortAddress; }
+	uint16_t getShortAddress() { return _record.shortAddress; }
+	void setAntennaDelay(uint16_t antennaDelay) { _record.antennaDelay = antennaDelay; }
+	uint16_t getAntennaDelay() { return _record.antennaDelay; }
+	void setMode(const byte mode[]) { memcpy(_record.mode, mode, 3); }
+	const byte *getMode() { return _record.mode; }
+
+	// Anchor coordinates [m] (e.g. from DW1000Survey), the solver matrices are computed here once.
+	// False if the layout is degenerate, the anchors are kept but without solver
+	boolean setAnchors(const uint16_t addresses[], const float anchors[][3], uint8_t count, uint8_t dimensions = 3);
+	uint8_t getAnchorCount() { return _record.anchorCount; }
+	uint16_t getAnchorAddress(uint8_t i) { return _record.anchorAddresses[i]; }
+	const float (*getAnchors())[3] { return _record.anchors; }
+	// Set up the solver from the stored matrices, no inversion
+	boolean loadSolver(DW1000Tdoa &solver);
+
+	const DW1000ConfigRecord &getRecord() { return _record; }
+
+private:
+	static uint32_t checksum(const DW1000ConfigRecord &record);
+
+	DW1000ConfigRecord _record;
+	const char *_file;
+};
+
+#endif
@@ -64,6 +64,7 @@
 #define PHR_MODE_SUB 16
 #define LEN_PHR_MODE_SUB 2
 #define RXM110K_BIT 22
+#define RXWTOE_BIT 28
 
 // device control register
 #define SYS_CTRL 0x0D
@@ -75,6 +76,7 @@
 #define WAIT4RESP_BIT 7
 #define RXENAB_BIT 8
 #define RXDLYS_BIT 9
+#define HRBPT_BIT 24
 
 // system event status register
 #define SYS_STATUS 0x0F
@@ -85,18 +87,24 @@
 #define TXPRS_BIT 5
 #define TXPHS_BIT 6
 #define TXFRS_BIT 7
+#define RXPRD_BIT 8
+#define RXSFDD_BIT 9
 #define LDEDONE_BIT 10
+#define RXPHD_BIT 11
 #define RXPHE_BIT 12
 #define RXDFR_BIT 13
 #define RXFCG_BIT 14
 #define RXFCE_BIT 15
 #define RXRFSL_BIT 16
 #define RXRFTO_BIT 17
+#define RXOVRR_BIT 20
 #define RXPTO_BIT 21
 #define RXSFDTO_BIT 26
 #define LDEERR_BIT 18
 #define RFPLL_LL_BIT 24
 #define CLKPLL_LL_BIT 25
+#define HSRBP_BIT 30
+#define ICRBP_BIT 31
 
 // system event mask register
 // NOTE: uses the bit definitions of SYS_STATUS (below 32)
@@ -143,6 +151,10 @@
 #define LEN_UWB_FRAMES 127
 #define LEN_EXT_UWB_FRAMES 1023
 
+// receive frame wait timeout period (units of 512/499.2 MHz, about 1.026 us)
+#define RX_FWTO 0x0C
+#define LEN_RX_FWTO 2
+
 // RX frame info
 #define RX_FINFO 0x10
 #define LEN_RX_FINFO 4
@@ -198,6 +210,9 @@
 #define LEN_DRX_TUNE1b 2
 #define LEN_DRX_TUNE2 4
 #define LEN_DRX_TUNE4H 2
+// carrier recovery integrator, 21 bit two's complement
+#define DRX_CAR_INT_SUB 0x28
+#define LEN_DRX_CAR_INT 3
 
 // LDE_CFG1 (for re-tuning only)
 #define LDE_IF 0x2E
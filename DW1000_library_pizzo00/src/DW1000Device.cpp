@@ -26,13 +26,32 @@
 // Constructor and destructor
 DW1000Device::DW1000Device()
 {
-	noteActivity();
+	init();
 }
 
 DW1000Device::DW1000Device(byte shortAddress[])
 {
 	// we set the 2 bytes address
 	setShortAddress(shortAddress);
+	init();
+}
+
+void DW1000Device::init()
+{
+	expectedMsgId = 0; // POLL
+	protocolFailed = false;
+	resetContention();
+	selected = false;
+	// new anchors start trusted, so they get polled once
+	successRate = 1;
+	pollIndex = 0xFF; // POLL_INDEX_NONE
+	compactRange = false;
+	rangeReportPending = false;
+	clockOffset = 0;
+	_hasPosition = false;
+	_zone = ZONE_NONE;
+	_zoneNeighbourCount = 0;
+	resetClockDrift();
 	noteActivity();
 }
 
@@ -41,6 +60,29 @@ DW1000Device::~DW1000Device() { }
 // setters:
 void DW1000Device::setShortAddress(byte deviceAddress[]) { memcpy(_shortAddress, deviceAddress, 2); }
 
+void DW1000Device::setPosition(const float position[3])
+{
+	memcpy(_position, position, sizeof(_position));
+	_hasPosition = true;
+}
+
+void DW1000Device::setZone(uint8_t zone, const uint8_t neighbours[], uint8_t count)
+{
+	_zone = zone;
+	_zoneNeighbourCount = count < ZONE_MAX_NEIGHBOURS ? count : ZONE_MAX_NEIGHBOURS;
+	memcpy(_zoneNeighbours, neighbours, _zoneNeighbourCount);
+}
+
+boolean DW1000Device::isZoneNeighbour(uint8_t zone)
+{
+	for (uint8_t i = 0; i < _zoneNeighbourCount; i++)
+	{
+		if (_zoneNeighbours[i] == zone)
+			return true;
+	}
+	return false;
+}
+
 uint16_t DW1000Device::getShortAddress()
 {
 	return _shortAddress[1] * 256 + _shortAddress[0];
@@ -51,6 +93,60 @@ boolean DW1000Device::isShortAddressEqual(DW1000Device *device)
 	return memcmp(this->getByteShortAddress(), device->getByteShortAddress(), 2) == 0;
 }
 
+void DW1000Device::resetContention()
+{
+	contentionBackoff = 0;
+	contentionDefer = 0;
+	rangingInitPending = false;
+}
+
+void DW1000Device::updateClockDrift(const DW1000Time &localSpan, const DW1000Time &remoteSpan)
+{
+	int64_t local = localSpan.getTimestamp();
+	if (local <= 0)
+	{
+		return;
+	}
+	// the difference is a few ppm of the span, float is enough from here
+	float sample = (float)(remoteSpan.getTimestamp() - local) / (float)local;
+
+	if (_clockDriftSamples < UINT16_MAX)
+	{
+		_clockDriftSamples++;
+	}
+	float gain = 1.0f / _clockDriftSamples;
+	if (gain < CLOCK_DRIFT_GAIN)
+	{
+		gain = CLOCK_DRIFT_GAIN;
+	}
+	// exponentially weighted mean and variance
+	float delta = sample - _clockDrift;
+	_clockDrift += gain * delta;
+	_clockDriftVariance = (1 - gain) * (_clockDriftVariance + gain * delta * delta);
+}
+
+void DW1000Device::resetClockDrift()
+{
+	_clockDrift = 0;
+	_clockDriftVariance = 0;
+	_clockDriftSamples = 0;
+}
+
+float DW1000Device::getClockDriftUncertainty()
+{
+	if (_clockDriftSamples == 0)
+	{
+		return CLOCK_DRIFT_MAX;
+	}
+	// the filter averages over about 2 / gain - 1 samples once converged
+	float samples = (float)_clockDriftSamples;
+	if (samples > 2 / CLOCK_DRIFT_GAIN - 1)
+	{
+		samples = 2 / CLOCK_DRIFT_GAIN - 1;
+	}
+	return getClockDriftDeviation() / sqrtf(samples);
+}
+
 void DW1000Device::noteActivity()
 {
 	_activity = millis();
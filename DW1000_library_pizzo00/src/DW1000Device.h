@@ -22,11 +22,21 @@
 
 #define INACTIVITY_TIME 2000
 
+// Clock drift fit: weight of a new sample once converged (1/n before), samples before
+// the estimate is used, and the drift above which the crystal is out of the DW1000 spec
+#define CLOCK_DRIFT_GAIN 0.1f
+#define CLOCK_DRIFT_MIN_SAMPLES 8
+#define CLOCK_DRIFT_MAX 20e-6f
+
 #ifndef _DW1000Device_H_INCLUDED
 #define _DW1000Device_H_INCLUDED
 
 #include "DW1000Time.h"
 
+// zone of a device that advertised none, and neighbour zones a device can advertise
+#define ZONE_NONE 0xFF
+#define ZONE_MAX_NEIGHBOURS 6
+
 class DW1000Device
 {
 public:
@@ -43,6 +53,10 @@ public:
 	void setFPPower(float power) { _FPPower = power; }
 	void setQuality(float quality) { _quality = quality; }
 	void setReplyTime(uint16_t replyDelayTimeUs) { _replyDelayTimeUs = replyDelayTimeUs; }
+	// anchor coordinates [m] advertised in its RANGING_INIT (tag side)
+	void setPosition(const float position[3]);
+	// anchor zone and its neighbour zones advertised in its RANGING_INIT (tag side)
+	void setZone(uint8_t zone, const uint8_t neighbours[], uint8_t count);
 
 	// Getters
 	uint8_t getIndex() { return _index; }
@@ -54,6 +68,10 @@ public:
 	float getRXPower() { return _RXPower; }
 	float getFPPower() { return _FPPower; }
 	float getQuality() { return _quality; }
+	boolean hasPosition() { return _hasPosition; }
+	const float *getPosition() { return _position; }
+	uint8_t getZone() { return _zone; }
+	boolean isZoneNeighbour(uint8_t zone);
 
 	boolean isAddressEqual(DW1000Device *device);
 	boolean isShortAddressEqual(DW1000Device *device);
@@ -68,6 +86,31 @@ public:
 	DW1000Time timeRangeReceived;
 
 	bool hasSentPoolAck;
+	// tag side: polled in the current selection, share of POLLs answered (smoothed)
+	bool selected;
+	float successRate;
+	// position in the last POLL (the tag's list, or ours in the tag's POLL on the anchor side)
+	// and whether the anchor understands RANGE_COMPACT (tag side)
+	uint8_t pollIndex;
+	bool compactRange;
+	// anchor side: the last exchange completed, its range (or RANGE RX timestamp with
+	// the tag side ranging) still has to go back in a POLL_ACK
+	bool rangeReportPending;
+	// tag side: smoothed clock offset of the anchor from the carrier integrator (remote / local rate - 1)
+	float clockOffset;
+
+	// protocol state of the exchange with this device (anchor side), so exchanges
+	// with several tags can be interleaved: message type expected next (a MessageType)
+	// and whether the current exchange went out of order
+	byte expectedMsgId;
+	bool protocolFailed;
+
+	// RANGING_INIT contention with this tag (anchor side): binary exponential backoff
+	// exponent, answer opportunities still to let pass and whether our last answer is pending
+	uint8_t contentionBackoff;
+	uint8_t contentionDefer;
+	bool rangingInitPending;
+	void resetContention();
 
 	DW1000Time timePollAckReceivedMinusPollSent;
 	DW1000Time timeRangeSentMinusPollAckReceived;
@@ -75,7 +118,22 @@ public:
 	void noteActivity();
 	boolean isInactive();
 
+	// Clock drift of this device relative to ours (remote rate / local rate - 1), fitted
+	// recursively from the length of one interval measured by both clocks
+	void updateClockDrift(const DW1000Time &localSpan, const DW1000Time &remoteSpan);
+	void resetClockDrift();
+	boolean hasClockDrift() { return _clockDriftSamples >= CLOCK_DRIFT_MIN_SAMPLES; }
+	float getClockDrift() { return _clockDrift; }
+	// spread of the samples, and uncertainty of the estimate itself
+	float getClockDriftDeviation() { return sqrtf(_clockDriftVariance); }
+	float getClockDriftUncertainty();
+	uint16_t getClockDriftSamples() { return _clockDriftSamples; }
+	boolean hasBadCrystal() { return hasClockDrift() && fabsf(_clockDrift) > CLOCK_DRIFT_MAX; }
+
 private:
+	// state of a newly discovered device, for both constructors
+	void init();
+
 	byte _shortAddress[2];
 	unsigned long _activity;
 	uint16_t _replyDelayTimeUs;
@@ -85,6 +143,16 @@ private:
 	float _RXPower;
 	float _FPPower;
 	float _quality;
+
+	boolean _hasPosition;
+	float _position[3];
+	uint8_t _zone;
+	uint8_t _zoneNeighbourCount;
+	uint8_t _zoneNeighbours[ZONE_MAX_NEIGHBOURS];
+
+	float _clockDrift;
+	float _clockDriftVariance;
+	uint16_t _clockDriftSamples;
 };
 
 #endif
@@ -0,0 +1,228 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file DW1000Locator.cpp
+ * Tag side anchor registry and position solver.
+ */
+
+#include "DW1000Locator.h"
+
+DW1000Locator::DW1000Locator()
+{
+	_dimensions = 3;
+	_count = 0;
+	_solves = 0;
+	_inversions = 0;
+	_residual = 0;
+	_hasPosition = false;
+	clearCache();
+}
+
+void DW1000Locator::setDimensions(uint8_t dimensions)
+{
+	_dimensions = dimensions;
+	clearCache();
+}
+
+void DW1000Locator::clearCache()
+{
+	for (uint8_t i = 0; i < LOCATOR_CACHE_SIZE; i++)
+		_cacheKeys[i] = 0;
+}
+
+void DW1000Locator::dropCachedAnchor(uint8_t index)
+{
+	for (uint8_t i = 0; i < LOCATOR_CACHE_SIZE; i++)
+	{
+		if (_cacheKeys[i] & ((uint32_t)1 << index))
+			_cacheKeys[i] = 0;
+	}
+}
+
+int16_t DW1000Locator::getAnchorIndex(uint16_t address)
+{
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		if (_addresses[i] == address)
+			return i;
+	}
+	return -1;
+}
+
+boolean DW1000Locator::setAnchor(uint16_t address, const float position[3], uint8_t zone)
+{
+	int16_t index = getAnchorIndex(address);
+	boolean known = index >= 0;
+	if (!known)
+	{
+		if (_count == LOCATOR_MAX_ANCHORS)
+			return false;
+		index = _count++;
+		_addresses[index] = address;
+		_rangeTimes[index] = 0;
+		_ranges[index] = 0;
+	}
+	_zones[index] = zone;
+	if (known && memcmp(_positions[index], position, sizeof(_positions[index])) == 0)
+	{
+		return true;
+	}
+	memcpy(_positions[index], position, sizeof(_positions[index]));
+	dropCachedAnchor(index);
+	return true;
+}
+
+boolean DW1000Locator::setAnchor(DW1000Device *device)
+{
+	if (!device->hasPosition())
+		return false;
+	return setAnchor(device->getShortAddress(), device->getPosition(), device->getZone());
+}
+
+void DW1000Locator::removeAnchor(uint16_t address)
+{
+	int16_t index = getAnchorIndex(address);
+	if (index < 0)
+		return;
+	// the last one takes its place, the indexes in the cache keys are not valid anymore
+	_count--;
+	_addresses[index] = _addresses[_count];
+	memcpy(_positions[index], _positions[_count], sizeof(_positions[index]));
+	_ranges[index] = _ranges[_count];
+	_rangeTimes[index] = _rangeTimes[_count];
+	_zones[index] = _zones[_count];
+	clearCache();
+}
+
+void DW1000Locator::setRange(uint16_t address, float range)
+{
+	int16_t index = getAnchorIndex(address);
+	if (index < 0 || range <= 0)
+		return;
+	_ranges[index] = range;
+	_rangeTimes[index] = millis();
+}
+
+boolean DW1000Locator::solve(float position[3])
+{
+	// the nearest anchors with a recent range
+	uint32_t now = millis();
+	uint32_t key = 0;
+	uint8_t used = 0;
+	while (used < TDOA_MAX_ANCHORS)
+	{
+		int16_t nearest = -1;
+		for (uint8_t i = 0; i < _count; i++)
+		{
+			if ((key & ((uint32_t)1 << i)) || _ranges[i] <= 0 || now - _rangeTimes[i] > LOCATOR_RANGE_EXPIRED)
+				continue;
+			if (nearest < 0 || _ranges[i] < _ranges[nearest])
+				nearest = i;
+		}
+		if (nearest < 0)
+			break;
+		key |= (uint32_t)1 << nearest;
+		used++;
+	}
+	if (used < _dimensions + 1)
+		return false;
+
+	// in index order, so an anchor set has one solver whatever the ranges
+	float ranges[TDOA_MAX_ANCHORS];
+	uint8_t n = 0;
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		if (key & ((uint32_t)1 << i))
+			ranges[n++] = _ranges[i];
+	}
+
+	_solves++;
+	uint8_t slot = 0;
+	for (uint8_t i = 0; i < LOCATOR_CACHE_SIZE; i++)
+	{
+		if (_cacheKeys[i] == key)
+		{
+			slot = i;
+			break;
+		}
+		// otherwise the least recently used one
+		if (_cacheKeys[i] == 0 || (_cacheKeys[slot] != 0 && _cacheUses[i] < _cacheUses[slot]))
+			slot = i;
+	}
+	if (_cacheKeys[slot] != key)
+	{
+		float anchors[TDOA_MAX_ANCHORS][3];
+		n = 0;
+		for (uint8_t i = 0; i < _count; i++)
+		{
+			if (key & ((uint32_t)1 << i))
+				memcpy(anchors[n++], _positions[i], sizeof(anchors[0]));
+		}
+		_inversions++;
+		_cacheKeys[slot] = 0;
+		if (!_cache[slot].setAnchors(anchors, n, _dimensions))
+			return false; // degenerate layout, e.g. anchors in a line
+		_cacheKeys[slot] = key;
+	}
+	_cacheUses[slot] = _solves;
+
+	if (!_cache[slot].solveRanges(ranges, position))
+		return false;
+	_residual = _cache[slot].getResidual();
+
+	if (_hasPosition && now - _positionTime > 0)
+	{
+		for (uint8_t k = 0; k < 3; k++)
+			_velocity[k] = 0.5f * _velocity[k] + 0.5f * (position[k] - _position[k]) / (now - _positionTime);
+	}
+	else
+	{
+		_velocity[0] = _velocity[1] = _velocity[2] = 0;
+	}
+	memcpy(_position, position, sizeof(_position));
+	_positionTime = now;
+	_hasPosition = true;
+	return true;
+}
+
+uint8_t DW1000Locator::predictZone(uint8_t activeZone)
+{
+	if (!_hasPosition)
+		return activeZone;
+	float predicted[3];
+	for (uint8_t k = 0; k < 3; k++)
+		predicted[k] = _position[k] + _velocity[k] * ZONE_PREDICTION_HORIZON;
+
+	float activeDistance = -1;
+	float nearestDistance = -1;
+	uint8_t nearestZone = activeZone;
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		if (_zones[i] == ZONE_NONE)
+			continue;
+		float d2 = 0;
+		for (uint8_t k = 0; k < _dimensions; k++)
+			d2 += (predicted[k] - _positions[i][k]) * (predicted[k] - _positions[i][k]);
+		float distance = sqrtf(d2);
+		if (_zones[i] == activeZone && (activeDistance < 0 || distance < activeDistance))
+			activeDistance = distance;
+		if (nearestDistance < 0 || distance < nearestDistance)
+		{
+			nearestDistance = distance;
+			nearestZone = _zones[i];
+		}
+	}
+	if (activeDistance < 0 || nearestDistance + ZONE_HYSTERESIS < activeDistance)
+		return nearestZone;
+	return activeZone;
+}
@@ -0,0 +1,96 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file DW1000Locator.h
+ * Tag side position from two-way ranges, with the anchors the tag discovered
+ * (coordinates advertised in RANGING_INIT) instead of a compiled anchor_matrix.
+ */
+
+#ifndef _DW1000Locator_H_INCLUDED
+#define _DW1000Locator_H_INCLUDED
+
+#include "DW1000Time.h"
+#include "DW1000Device.h"
+#include "DW1000Tdoa.h"
+
+// anchors known by their address and coordinates, at most 32 (bit mask of the solver cache)
+#define LOCATOR_MAX_ANCHORS 32
+// solvers kept for the last anchor sets used, each one is a pseudo-inverse
+#define LOCATOR_CACHE_SIZE 4
+// ranges older than this [ms] are not used
+#define LOCATOR_RANGE_EXPIRED 5000
+// zone handover: look ahead [ms] along the tag velocity, and how much nearer [m] an anchor of
+// another zone must be than the nearest anchor of the active zone
+#define ZONE_PREDICTION_HORIZON 1000
+#define ZONE_HYSTERESIS 0.5f
+
+class DW1000Locator
+{
+public:
+	DW1000Locator();
+
+	// 3D, or 2D with the tag in the plane of the anchors
+	void setDimensions(uint8_t dimensions);
+
+	// Anchor registry. An anchor moved (new coordinates) drops the solvers that use it
+	boolean setAnchor(uint16_t address, const float position[3], uint8_t zone = ZONE_NONE);
+	// from the RANGING_INIT of the anchor (coordinates and zone), false without coordinates
+	boolean setAnchor(DW1000Device *device);
+	void removeAnchor(uint16_t address);
+	int16_t getAnchorIndex(uint16_t address);
+	uint8_t getAnchorCount() { return _count; }
+	uint16_t getAnchorAddress(uint8_t i) { return _addresses[i]; }
+	const float *getAnchorPosition(uint8_t i) { return _positions[i]; }
+
+	// New range [m] to an anchor, ignored if the anchor is not in the registry
+	void setRange(uint16_t address, float range);
+	// Least squares position from the recent ranges of the (at most TDOA_MAX_ANCHORS) nearest
+	// anchors. The pseudo-inverse of an anchor set is computed on its first use only
+	boolean solve(float position[3]);
+	// rms of the range residuals [m] of the last solution
+	float getResidual() { return _residual; }
+	// pseudo-inverses computed so far (solver cache misses)
+	uint32_t getInversions() { return _inversions; }
+
+	// Zone the tag will be in: the zone of the anchor nearest to the position predicted
+	// ZONE_PREDICTION_HORIZON ahead, with hysteresis. For DW1000Ranging::handOver()
+	uint8_t predictZone(uint8_t activeZone);
+
+private:
+	void clearCache();
+	void dropCachedAnchor(uint8_t index);
+
+	uint8_t _dimensions;
+	uint8_t _count;
+	uint16_t _addresses[LOCATOR_MAX_ANCHORS];
+	float _positions[LOCATOR_MAX_ANCHORS][3];
+	float _ranges[LOCATOR_MAX_ANCHORS];
+	uint32_t _rangeTimes[LOCATOR_MAX_ANCHORS];
+	uint8_t _zones[LOCATOR_MAX_ANCHORS];
+
+	// last solution and smoothed velocity [m/ms]
+	boolean _hasPosition;
+	float _position[3];
+	float _velocity[3];
+	uint32_t _positionTime;
+
+	// anchor set (bit per registry index) of each solver, 0 if unused, and last use
+	uint32_t _cacheKeys[LOCATOR_CACHE_SIZE];
+	uint32_t _cacheUses[LOCATOR_CACHE_SIZE];
+	DW1000Tdoa _cache[LOCATOR_CACHE_SIZE];
+	uint32_t _solves;
+	uint32_t _inversions;
+	float _residual;
+};
+
+#endif
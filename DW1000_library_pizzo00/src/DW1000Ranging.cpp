@@ -32,18 +32,29 @@
 DW1000RangingClass DW1000Ranging;
 
 constexpr short rangeDeviceSize = 12;
-constexpr short pollDeviceSize = 4;
-constexpr uint8_t devicePerPollTransmit = 4;
-constexpr uint8_t pollAckTimeSlots = 6;
+// RANGE_COMPACT entry: POLL index and two 32 bit differences
+constexpr short rangeCompactDeviceSize = 9;
+// POLL: type, device count, slot width [us] and first slot, then one address per device,
+// the reply slot of a device follows from its position in the list
+constexpr short pollHeaderSize = 5;
+constexpr short pollDeviceSize = 2;
+// POLL_ACK: type, capability marker and flags, reported range, then the anchor timestamps
+// (POLL RX, POLL_ACK TX and RX of the previous RANGE) for the tag side ranging
+constexpr short pollAckRangeOffset = 3;
+constexpr short pollAckTimestampsOffset = 7;
 
 DW1000Device DW1000RangingClass::_networkDevices[MAX_DEVICES];
 byte DW1000RangingClass::_ownLongAddress[8];
 byte DW1000RangingClass::_ownShortAddress[2];
-byte DW1000RangingClass::_lastSentToShortAddress[2];
 DW1000Mac DW1000RangingClass::_globalMac;
 BoardType DW1000RangingClass::_type;
 volatile MessageType DW1000RangingClass::_expectedMsgId;
-byte DW1000RangingClass::receivedData[LEN_DATA];
+DW1000RangingClass::ReceivedFrame DW1000RangingClass::_receivedFrames[RECEIVE_QUEUE_SIZE];
+volatile uint8_t DW1000RangingClass::_receivedFramesIn;
+volatile uint8_t DW1000RangingClass::_receivedFramesOut;
+uint32_t DW1000RangingClass::_receivedFramesDropped;
+DW1000RangingClass::ReceivedFrame *DW1000RangingClass::_receivedFrame;
+byte *DW1000RangingClass::receivedData;
 byte DW1000RangingClass::sentData[LEN_DATA];
 uint8_t DW1000RangingClass::_RST;
 uint8_t DW1000RangingClass::_SS;
@@ -53,15 +64,64 @@ uint16_t DW1000RangingClass::_timerDelay;
 volatile uint8_t DW1000RangingClass::_networkDevicesNumber;
 volatile boolean DW1000RangingClass::_sentAck;
 volatile boolean DW1000RangingClass::_receivedAck;
-boolean DW1000RangingClass::_protocolFailed;
 uint32_t DW1000RangingClass::lastTimerTick;
 uint32_t DW1000RangingClass::_replyTimeOfLastPollAck;
 uint32_t DW1000RangingClass::_timeOfLastPollSent;
 uint16_t DW1000RangingClass::_addressOfExpectedLastPollAck;
+uint32_t DW1000RangingClass::_pollAckWindowLength;
+volatile boolean DW1000RangingClass::_pollAckWindowClosed;
+boolean DW1000RangingClass::_superframeCoordinator;
+byte DW1000RangingClass::_superframeSlots[SUPERFRAME_MAX_SLOTS][2];
+boolean DW1000RangingClass::_superframeSynchronized;
+uint8_t DW1000RangingClass::_superframeSlot;
+DW1000Time DW1000RangingClass::_beaconReceived;
+uint32_t DW1000RangingClass::_beaconMicros;
+uint32_t DW1000RangingClass::_slotOffset;
+boolean DW1000RangingClass::_superframeSlotDone;
+boolean DW1000RangingClass::_transmitInSlot;
+uint32_t DW1000RangingClass::_missedSlots;
+uint8_t DW1000RangingClass::_superframeSlotCount;
+uint32_t DW1000RangingClass::_superframeSlotDuration;
+uint32_t DW1000RangingClass::_lastBeaconTime;
+boolean DW1000RangingClass::_tdoa;
+boolean DW1000RangingClass::_tdoaReferenceAnchor;
+uint8_t DW1000RangingClass::_syncSequence;
+uint32_t DW1000RangingClass::_lastSyncTime;
+DW1000Time DW1000RangingClass::_syncSent;
+DW1000Time DW1000RangingClass::_syncReceived;
+uint32_t DW1000RangingClass::_lastSyncReceivedTime;
+DW1000Device DW1000RangingClass::_tdoaReference;
+DW1000Time DW1000RangingClass::_tdoaReferenceTof;
+boolean DW1000RangingClass::_hasPosition;
+uint8_t DW1000RangingClass::_zone;
+uint8_t DW1000RangingClass::_zoneNeighbourCount;
+uint8_t DW1000RangingClass::_zoneNeighbours[ZONE_MAX_NEIGHBOURS];
+float DW1000RangingClass::_position[3];
+uint16_t DW1000RangingClass::_surveyCyclesLeft;
+uint16_t DW1000RangingClass::_calibratorAddress;
+uint32_t DW1000RangingClass::_surveyPeriod;
+uint32_t DW1000RangingClass::_lastSurveyTime;
+uint8_t DW1000RangingClass::_surveyCount;
+uint16_t DW1000RangingClass::_surveyAddresses[SURVEY_MAX_ANCHORS];
+float DW1000RangingClass::_surveyRangeSum[SURVEY_MAX_ANCHORS];
+uint16_t DW1000RangingClass::_surveyRangeCount[SURVEY_MAX_ANCHORS];
 int16_t DW1000RangingClass::counterForBlink;
+uint32_t DW1000RangingClass::_contentionRandom;
+uint8_t DW1000RangingClass::_blinkInterval;
+boolean DW1000RangingClass::_blinkFoundDevice;
+uint32_t DW1000RangingClass::_blinksSent;
+uint32_t DW1000RangingClass::_rangingCycles;
 uint16_t DW1000RangingClass::_rangeInterval;
+uint16_t DW1000RangingClass::_replyDelayTime;
+uint8_t DW1000RangingClass::_anchorsPerRound;
+uint8_t DW1000RangingClass::_pollAckTimeSlots;
+uint32_t DW1000RangingClass::_lateReplies;
+uint32_t DW1000RangingClass::_pollAckWatchdogCount;
 uint32_t DW1000RangingClass::_rangingCountPeriod;
 void (*DW1000RangingClass::_handleNewRange)(DW1000Device *);
+void (*DW1000RangingClass::_handleTdoaBlink)(uint16_t, uint8_t, const DW1000Time &);
+void (*DW1000RangingClass::_handleSurveyDone)(const uint16_t[], const float[], uint8_t);
+void (*DW1000RangingClass::_handleAntennaDelay)(uint16_t);
 void (*DW1000RangingClass::_handleBlinkDevice)(DW1000Device *);
 void (*DW1000RangingClass::_handleNewDevice)(DW1000Device *);
 void (*DW1000RangingClass::_handleInactiveDevice)(DW1000Device *);
@@ -79,15 +139,53 @@ void DW1000RangingClass::init(BoardType type, const uint8_t *wifiMacAddress, uin
 	_networkDevicesNumber = 0;
 	_sentAck = false;
 	_receivedAck = false;
-	_protocolFailed = false;
+	_receivedFramesIn = 0;
+	_receivedFramesOut = 0;
+	_receivedFramesDropped = 0;
 	lastTimerTick = 0;
 	_replyTimeOfLastPollAck = 0;
 	_addressOfExpectedLastPollAck = 0;
 	_timeOfLastPollSent = 0;
+	_pollAckWindowLength = 0;
+	_pollAckWindowClosed = false;
+	_superframeCoordinator = false;
+	_superframeSynchronized = false;
+	_superframeSlot = SUPERFRAME_NO_SLOT;
+	_superframeSlotDone = true;
+	_transmitInSlot = false;
+	_missedSlots = 0;
+	_superframeSlotCount = 0;
+	_superframeSlotDuration = 0;
+	_lastBeaconTime = 0;
+	_tdoa = false;
+	_tdoaReferenceAnchor = false;
+	_syncSequence = 0;
+	_lastSyncTime = 0;
+	_lastSyncReceivedTime = 0;
+	_hasPosition = false;
+	_zone = ZONE_NONE;
+	_zoneNeighbourCount = 0;
+	_surveyCyclesLeft = 0;
+	_surveyPeriod = 0;
+	_lastSurveyTime = 0;
+	_surveyCount = 0;
+	_calibratorAddress = CALIBRATOR_NONE;
 	counterForBlink = 0; // TODO 8 bit?
+	_blinkInterval = BLINK_INTERVAL;
+	_blinkFoundDevice = false;
+	_blinksSent = 0;
+	_rangingCycles = 0;
 	_rangeInterval = DEFAULT_RANGE_INTERVAL;
+	_replyDelayTime = DEFAULT_REPLY_DELAY_TIME;
+	_anchorsPerRound = DEFAULT_ANCHORS_PER_ROUND;
+	_pollAckTimeSlots = DEFAULT_ANCHORS_PER_ROUND + POLL_FREE_SLOTS;
+	_lateReplies = 0;
+	_pollAckWatchdogCount = 0;
 	_rangingCountPeriod = 0;
 	_handleNewRange = 0;
+	_handleTdoaBlink = 0;
+	_handleSurveyDone = 0;
+	_handleAntennaDelay = 0;
 	_handleBlinkDevice = 0;
 	_handleNewDevice = 0;
 	_handleInactiveDevice = 0;
@@ -109,6 +207,9 @@ void DW1000RangingClass::init(BoardType type, const uint8_t *wifiMacAddress, uin
 	_ownShortAddress[0] = _ownLongAddress[0];
 	_ownShortAddress[1] = _ownLongAddress[1];
 
+	// different anchors draw different contention slots for the same tag
+	_contentionRandom = ((uint32_t)shortAddress + 1) * 2654435761u;
+
 	// write the address on the DW1000 chip
 	DW1000.setEUI(_ownLongAddress);
 
@@ -147,6 +248,8 @@ void DW1000RangingClass::initCommunication(uint8_t myRST, uint8_t mySS, uint8_t
 	_timerDelay = _rangeInterval;
 
 	DW1000.begin(myIRQ, myRST);
+	// SYS_STATUS is read and the handlers run from loop(), not in the IRQ handler
+	DW1000.useDeferredInterrupts(true);
 	DW1000.select(mySS);
 }
 
@@ -158,6 +261,11 @@ void DW1000RangingClass::configureNetwork(uint16_t deviceAddress, uint16_t netwo
 	DW1000.setDeviceAddress(deviceAddress);
 	DW1000.setNetworkId(networkId);
 	DW1000.enableMode(mode);
+	// receive into both RX buffers, so a frame arriving while loop() is busy is not lost
+	DW1000.setDoubleBuffering(true);
+	DW1000.useExtendedFrameLength(DW1000_EXTENDED_FRAMES);
+	// the tag closes its POLL_ACK window on the receive timeout
+	DW1000.interruptOnReceiveTimeout(true);
 	DW1000.commitConfiguration();
 }
 
@@ -166,6 +274,7 @@ void DW1000RangingClass::generalStart(bool high_power)
 	// attach callback for (successfully) sent and received messages
 	DW1000.attachSentHandler(handleSent);
 	DW1000.attachReceivedHandler(handleReceived);
+	DW1000.attachReceiveTimeoutHandler(handleReceiveTimeout);
 	// anchor starts in receiving mode, awaiting a ranging poll message
 
 	/*
@@ -331,6 +440,8 @@ uint32_t DEBUGRangeSent;
 
 void DW1000RangingClass::loop()
 {
+	// service the chip events latched by the IRQ handler
+	DW1000.processInterrupts();
 	// we check if needed to reset!
 	checkForReset();
 	uint32_t currentTime = millis();
@@ -340,11 +451,32 @@ void DW1000RangingClass::loop()
 		timerTick();
 	}
 
+	if (_superframeCoordinator && currentTime - _lastBeaconTime >= getSuperframePeriod() / 1000)
+	{
+		transmitBeacon();
+	}
+	else if (_superframeSynchronized)
+	{
+		superframeTick();
+	}
+
+	if (_tdoaReferenceAnchor && currentTime - _lastSyncTime >= TDOA_SYNC_INTERVAL)
+	{
+		transmitSync();
+	}
+
+	if (_surveyPeriod != 0 && !isSurveying() && currentTime - _lastSurveyTime >= _surveyPeriod)
+	{
+		startSurvey();
+	}
+
 	if (!_sentAck && !_receivedAck)
 	{
-		if (_replyTimeOfLastPollAck != 0 && currentTime - _timeOfLastPollSent > _replyTimeOfLastPollAck + 3)
+		// watchdog only, the window is closed by the receive timeout of the chip
+		if (_replyTimeOfLastPollAck != 0 && currentTime - _timeOfLastPollSent > _replyTimeOfLastPollAck + POLL_ACK_WATCHDOG_MARGIN)
 		{
-			m_log::log_vrb(LOG_DW1000_MSG, "RANGE ON TIMEOUT");
+			_pollAckWatchdogCount++;
+			m_log::log_inf(LOG_DW1000_MSG, "RANGE ON WATCHDOG");
 			transmitRange();
 		}
 	}
@@ -365,6 +497,9 @@ void DW1000RangingClass::loop()
 		case MessageType::RANGE:
 			m_log::log_dbg(LOG_DW1000_MSG, "RANGE");
 			break;
+		case MessageType::RANGE_COMPACT:
+			m_log::log_dbg(LOG_DW1000_MSG, "RANGE_COMPACT");
+			break;
 		case MessageType::RANGE_REPORT:
 			m_log::log_dbg(LOG_DW1000_MSG, "RANGE_REPORT");
 			break;
@@ -374,6 +509,15 @@ void DW1000RangingClass::loop()
 		case MessageType::RANGING_INIT:
 			m_log::log_dbg(LOG_DW1000_MSG, "RANGING_INIT");
 			break;
+		case MessageType::BEACON:
+			m_log::log_dbg(LOG_DW1000_MSG, "BEACON");
+			break;
+		case MessageType::SYNC:
+			m_log::log_dbg(LOG_DW1000_MSG, "SYNC");
+			break;
+		case MessageType::ANTENNA_DELAY:
+			m_log::log_dbg(LOG_DW1000_MSG, "ANTENNA_DELAY");
+			break;
 		case MessageType::TYPE_ERROR:
 			m_log::log_dbg(LOG_DW1000_MSG, "TYPE_ERROR");
 			break;
@@ -382,24 +526,12 @@ void DW1000RangingClass::loop()
 			break;
 		};
 
-		if (messageType != MessageType::POLL_ACK && messageType != MessageType::POLL && messageType != MessageType::RANGE)
+		if (messageType != MessageType::POLL_ACK && messageType != MessageType::POLL && messageType != MessageType::RANGE && messageType != MessageType::RANGE_COMPACT)
 			return;
 
 		// A msg was sent. We launch the ranging protocol when a message was sent
-		if (_type == BoardType::ANCHOR)
-		{
-			if (messageType == MessageType::POLL_ACK)
-			{
-				DW1000Device *myDistantDevice = searchDistantDevice(_lastSentToShortAddress);
-
-				if (myDistantDevice)
-				{
-					// myDistantDevice->noteActivity(); // Not active, just a submission
-					DW1000.getTransmitTimestamp(myDistantDevice->timePollAckSent);
-				}
-			}
-		}
-		else if (_type == BoardType::TAG)
+		// (the anchor knows the POLL_ACK send time when scheduling it, see transmitPollAck())
+		if (_type == BoardType::TAG)
 		{
 			if (messageType == MessageType::POLL)
 			{
@@ -415,7 +547,7 @@ void DW1000RangingClass::loop()
 					_networkDevices[i].hasSentPoolAck = false;
 				}
 			}
-			else if (messageType == MessageType::RANGE)
+			else if (messageType == MessageType::RANGE || messageType == MessageType::RANGE_COMPACT)
 			{
 				DW1000Time timeRangeSent;
 				DW1000.getTransmitTimestamp(timeRangeSent);
@@ -428,344 +560,558 @@ void DW1000RangingClass::loop()
 		}
 	}
 
-	// check for new received message
+	// check for new received messages, one per filled RX buffer
 	if (_receivedAck)
 	{
 		_receivedAck = false;
 
-		// we read the datas from the modules:
-		//  get message and parse
-		DW1000.getData(receivedData, LEN_DATA);
-
-		MessageType messageType = detectMessageType(receivedData);
+		while (_receivedFramesOut != _receivedFramesIn)
+		{
+			_receivedFrame = &_receivedFrames[_receivedFramesOut % RECEIVE_QUEUE_SIZE];
+			receivedData = _receivedFrame->data;
+			handleReceivedFrame();
+			// release the slot only now, handleReceived() may be filling the other one
+			_receivedFramesOut++;
+		}
+	}
 
-		switch (messageType)
+	// the chip closed the POLL_ACK window, all POLL_ACKs it got are handled above
+	if (_pollAckWindowClosed)
+	{
+		_pollAckWindowClosed = false;
+		if (_replyTimeOfLastPollAck != 0)
 		{
-		case MessageType::POLL:
-			m_log::log_dbg(LOG_DW1000_MSG, "<=POLL");
-			break;
-		case MessageType::POLL_ACK:
-			m_log::log_dbg(LOG_DW1000_MSG, "<=POLL_ACK");
-			break;
-		case MessageType::RANGE:
-			m_log::log_dbg(LOG_DW1000_MSG, "<=RANGE");
-			break;
-		case MessageType::RANGE_REPORT:
-			m_log::log_dbg(LOG_DW1000_MSG, "<=RANGE_REPORT");
-			break;
-		case MessageType::BLINK:
-			m_log::log_dbg(LOG_DW1000_MSG, "<=BLINK");
-			break;
-		case MessageType::RANGING_INIT:
-			m_log::log_dbg(LOG_DW1000_MSG, "<=RANGING_INIT");
-			break;
-		case MessageType::TYPE_ERROR:
-			m_log::log_dbg(LOG_DW1000_MSG, "<=TYPE_ERROR");
-			break;
-		case MessageType::RANGE_FAILED:
-			m_log::log_dbg(LOG_DW1000_MSG, "<=RANGE_FAILED");
-			break;
-		};
+			m_log::log_vrb(LOG_DW1000_MSG, "RANGE ON RX TIMEOUT");
+			transmitRange();
+		}
+	}
+}
+
+void DW1000RangingClass::handleReceivedFrame()
+{
+	MessageType messageType = detectMessageType(receivedData);
 
-		// we have just received a BLINK message from tag
-		if (messageType == MessageType::BLINK && _type == BoardType::ANCHOR)
+	switch (messageType)
+	{
+	case MessageType::POLL:
+		m_log::log_dbg(LOG_DW1000_MSG, "<=POLL");
+		break;
+	case MessageType::POLL_ACK:
+		m_log::log_dbg(LOG_DW1000_MSG, "<=POLL_ACK");
+		break;
+	case MessageType::RANGE:
+		m_log::log_dbg(LOG_DW1000_MSG, "<=RANGE");
+		break;
+	case MessageType::RANGE_COMPACT:
+		m_log::log_dbg(LOG_DW1000_MSG, "<=RANGE_COMPACT");
+		break;
+	case MessageType::RANGE_REPORT:
+		m_log::log_dbg(LOG_DW1000_MSG, "<=RANGE_REPORT");
+		break;
+	case MessageType::BLINK:
+		m_log::log_dbg(LOG_DW1000_MSG, "<=BLINK");
+		break;
+	case MessageType::RANGING_INIT:
+		m_log::log_dbg(LOG_DW1000_MSG, "<=RANGING_INIT");
+		break;
+	case MessageType::BEACON:
+		m_log::log_dbg(LOG_DW1000_MSG, "<=BEACON");
+		break;
+	case MessageType::SYNC:
+		m_log::log_dbg(LOG_DW1000_MSG, "<=SYNC");
+		break;
+	case MessageType::ANTENNA_DELAY:
+		m_log::log_dbg(LOG_DW1000_MSG, "<=ANTENNA_DELAY");
+		break;
+	case MessageType::TYPE_ERROR:
+		m_log::log_dbg(LOG_DW1000_MSG, "<=TYPE_ERROR");
+		break;
+	case MessageType::RANGE_FAILED:
+		m_log::log_dbg(LOG_DW1000_MSG, "<=RANGE_FAILED");
+		break;
+	};
+
+	if (messageType == MessageType::ANTENNA_DELAY)
+	{
+		// whatever the role of the board
+		handleAntennaDelays();
+		return;
+	}
+
+	if (_tdoa)
+	{
+		// no two-way ranging, anchors only timestamp BLINKs
+		if (_type == BoardType::ANCHOR && messageType == MessageType::BLINK)
+			handleTdoaBlink();
+		else if (_type == BoardType::ANCHOR && messageType == MessageType::SYNC)
+			handleSync();
+		return;
+	}
+
+	// we have just received a BLINK message from tag
+	if (messageType == MessageType::BLINK && _type == BoardType::ANCHOR)
+	{
+		if (!isTagZoneServed(receivedData[BLINK_MAC_LEN + BLINK_FILTER_LEN]))
 		{
-			byte shortAddress[2];
-			_globalMac.decodeBlinkFrame(receivedData, shortAddress);
+			// the anchors of the zone of the tag and of the neighbours answer
+			return;
+		}
 
-			bool knownByTheTag = false;
+		byte shortAddress[2];
+		_globalMac.decodeBlinkFrame(receivedData, shortAddress);
 
-			uint8_t numberDevices = receivedData[BLINK_MAC_LEN];
-			for (uint8_t i = 0; i < numberDevices; i++)
-			{
-				// we check if the tag know us
-				byte shortAddress[2];
-				memcpy(shortAddress, receivedData + BLINK_MAC_LEN + 1 + i * 2, 2);
-				// we test if the short address is our address
-				if (shortAddress[0] == _ownShortAddress[0] &&
-					shortAddress[1] == _ownShortAddress[1])
-					knownByTheTag = true;
-			}
+		// we check if the tag know us, BLINK_FILTER_HASHES bit tests whatever the anchor count
+		bool knownByTheTag = isInBlinkFilter(receivedData + BLINK_MAC_LEN, _ownShortAddress);
 
-			// we create a new device with the tag
-			DW1000Device myTag(shortAddress);
-			myTag.setRXPower(DW1000.getReceivePower());
-			myTag.setFPPower(DW1000.getFirstPathPower());
-			myTag.setQuality(DW1000.getReceiveQuality());
+		// we create a new device with the tag
+		DW1000Device myTag(shortAddress);
+		myTag.setRXPower(_receivedFrame->rxPower);
+		myTag.setFPPower(_receivedFrame->fpPower);
+		myTag.setQuality(_receivedFrame->quality);
 
-			if (addNetworkDevices(&myTag))
-			{
-				if (_handleBlinkDevice != 0)
-				{
-					(*_handleBlinkDevice)(&myTag);
-				}
-			}
+		boolean newTag = addNetworkDevices(&myTag);
+		if (newTag && _handleBlinkDevice != 0)
+		{
+			(*_handleBlinkDevice)(&myTag);
+		}
+		DW1000Device *tag = searchDistantDevice(shortAddress);
+		if (!newTag && tag != nullptr)
+		{
+			// a known tag blinks again, its next exchange starts from a POLL
+			tag->expectedMsgId = static_cast<byte>(MessageType::POLL);
+		}
 
-			if (!knownByTheTag)
+		if (_superframeCoordinator)
+		{
+			// the tag joins the superframe, its slot is in the next BEACON
+			assignSuperframeSlot(shortAddress);
+		}
+
+		if (knownByTheTag)
+		{
+			if (tag != nullptr)
+				tag->resetContention();
+		}
+		else if (tag != nullptr)
+		{
+			// we reply by the transmit ranging init message
+			int16_t slot = contentionSlot(tag, RANGING_INIT_SLOTS);
+			if (slot >= 0)
 			{
-				// we reply by the transmit ranging init message
-				constexpr short slotQty = 7;
-				constexpr u_int16_t slotDuration = 2.5 * DEFAULT_REPLY_DELAY_TIME;
-				int randomSlot = random(0, slotQty) + 1;
-				// randomSlot = (_ownShortAddress[0] % slotQty) + 1;
-				u_int16_t delay = slotDuration * randomSlot;
-				// Serial.println(delay);
-				transmitRangingInit(delay);
+				u_int16_t slotDuration = 5 * _replyDelayTime / 2;
+				transmitRangingInit(slotDuration * (slot + 1));
 			}
-			noteActivity();
+		}
+		noteActivity();
+	}
+	else if (messageType == MessageType::RANGING_INIT && _type == BoardType::TAG)
+	{
+
+		byte address[2];
+		_globalMac.decodeShortMACFrame(receivedData, address);
+		// we crate a new device with the anchor
+		DW1000Device myAnchor(address);
+		myAnchor.setRXPower(_receivedFrame->rxPower);
+		myAnchor.setFPPower(_receivedFrame->fpPower);
+		myAnchor.setQuality(_receivedFrame->quality);
+
+		m_log::log_vrb(LOG_DW1000_MSG, "RANGING_INIT from %x", myAnchor.getShortAddress());
 
-			_expectedMsgId = MessageType::POLL;
+		byte flags = receivedData[SHORT_MAC_LEN + 1];
+		byte *payload = receivedData + SHORT_MAC_LEN + 2;
+		float position[3];
+		if (flags & RANGING_INIT_POSITION)
+		{
+			memcpy(position, payload, sizeof(position));
+			myAnchor.setPosition(position);
+			payload += sizeof(position);
 		}
-		else if (messageType == MessageType::RANGING_INIT && _type == BoardType::TAG)
+		if (flags & RANGING_INIT_ZONE)
 		{
+			myAnchor.setZone(payload[0], payload + 2, payload[1]);
+		}
 
-			byte address[2];
-			_globalMac.decodeShortMACFrame(receivedData, address);
-			// we crate a new device with the anchor
-			DW1000Device myAnchor(address);
-			myAnchor.setRXPower(DW1000.getReceivePower());
-			myAnchor.setFPPower(DW1000.getFirstPathPower());
-			myAnchor.setQuality(DW1000.getReceiveQuality());
-
-			m_log::log_vrb(LOG_DW1000_MSG, "RANGING_INIT from %x", myAnchor.getShortAddress());
+		if (!isAnchorZoneKept(&myAnchor))
+		{
+			// an anchor of a zone far from ours
+			return;
+		}
+		if (_zone == ZONE_NONE && myAnchor.getZone() != ZONE_NONE)
+		{
+			_zone = myAnchor.getZone();
+			m_log::log_inf(LOG_DW1000, "Zone %d", _zone);
+		}
 
-			if (addNetworkDevices(&myAnchor))
+		if (addNetworkDevices(&myAnchor))
+		{
+			// keep blinking often while the BLINKs find anchors
+			_blinkFoundDevice = true;
+			if (_handleNewDevice != 0)
 			{
-				if (_handleNewDevice != 0)
-				{
-					(*_handleNewDevice)(&myAnchor);
-				}
+				(*_handleNewDevice)(&myAnchor);
 			}
-
-			noteActivity();
 		}
-		else
+		else if (flags & (RANGING_INIT_POSITION | RANGING_INIT_ZONE))
+		{
+			// the anchor may have been surveyed or assigned again
+			DW1000Device *known = searchDistantDevice(address);
+			if (flags & RANGING_INIT_POSITION)
+				known->setPosition(position);
+			if (flags & RANGING_INIT_ZONE)
+				known->setZone(payload[0], payload + 2, payload[1]);
+		}
+
+		noteActivity();
+	}
+	else if (messageType == MessageType::BEACON)
+	{
+		if (_type == BoardType::TAG)
 		{
-			// we have a short mac layer frame !
-			byte address[2];
-			_globalMac.decodeShortMACFrame(receivedData, address);
+			handleBeacon();
+		}
+	}
+	else
+	{
+		// we have a short mac layer frame !
+		byte address[2];
+		_globalMac.decodeShortMACFrame(receivedData, address);
 
-			// we get the device which correspond to the message which was sent (need to be filtered by MAC address)
-			DW1000Device *myDistantDevice = searchDistantDevice(address);
+		// we get the device which correspond to the message which was sent (need to be filtered by MAC address)
+		DW1000Device *myDistantDevice = searchDistantDevice(address);
 
-			// then we proceed to range protocol
-			if (_type == BoardType::ANCHOR)
+		// then we proceed to range protocol
+		if (_type == BoardType::ANCHOR)
+		{
+			// both RANGE formats are the same protocol step
+			MessageType protocolStep = messageType == MessageType::RANGE_COMPACT ? MessageType::RANGE : messageType;
+			if (myDistantDevice != nullptr && protocolStep != static_cast<MessageType>(myDistantDevice->expectedMsgId))
 			{
-				if (myDistantDevice != nullptr && messageType != _expectedMsgId)
-				{
-					// unexpected message, start over again (except if already POLL)
-					_protocolFailed = true;
-				}
-				if (messageType == MessageType::POLL)
+				// unexpected message from this tag, start over again (except if already POLL)
+				myDistantDevice->protocolFailed = true;
+			}
+			if (messageType == MessageType::POLL)
+			{
+				if (myDistantDevice == nullptr)
 				{
+					// we create a new device with the tag
+					DW1000Device myTag(address);
+					myTag.setRXPower(_receivedFrame->rxPower);
+					myTag.setFPPower(_receivedFrame->fpPower);
+					myTag.setQuality(_receivedFrame->quality);
+					if (addNetworkDevices(&myTag))
+					{
+						// the exchange state lives in the copy in _networkDevices
+						myDistantDevice = searchDistantDevice(address);
+						if (_handleNewDevice != 0)
+							(*_handleNewDevice)(myDistantDevice);
+					}
 					if (myDistantDevice == nullptr)
 					{
-						// we create a new device with the tag
-						DW1000Device myTag(address);
-						myTag.setRXPower(DW1000.getReceivePower());
-						myTag.setFPPower(DW1000.getFirstPathPower());
-						myTag.setQuality(DW1000.getReceiveQuality());
-						if (addNetworkDevices(&myTag))
-						{
-							myDistantDevice = &myTag;
-							if (_handleNewDevice != 0)
-								(*_handleNewDevice)(&myTag);
-						}
-						else
-						{
-							return;
-						}
+						return;
 					}
+				}
 
-					// we receive a POLL which is a broadcast message
-					// we need to grab info about it
-					uint8_t numberDevices = receivedData[SHORT_MAC_LEN + 1];
+				// we receive a POLL which is a broadcast message
+				// we need to grab info about it
+				uint8_t numberDevices = receivedData[SHORT_MAC_LEN + 1];
+				uint16_t slotWidth;
+				memcpy(&slotWidth, receivedData + SHORT_MAC_LEN + 2, 2);
+				uint8_t firstSlot = receivedData[SHORT_MAC_LEN + 4];
+				myDistantDevice->pollIndex = POLL_INDEX_NONE;
 
-					for (uint8_t i = 0; i < numberDevices; i++)
+				for (uint8_t i = 0; i < numberDevices; i++)
+				{
+					// we need to test if this value is for us:
+					// we grab the mac address of each devices:
+					byte shortAddress[2];
+					memcpy(shortAddress, receivedData + SHORT_MAC_LEN + pollHeaderSize + i * pollDeviceSize, 2);
+
+					// we test if the short address is our address
+					if (shortAddress[0] == _ownShortAddress[0] &&
+						shortAddress[1] == _ownShortAddress[1])
 					{
-						// we need to test if this value is for us:
-						// we grab the mac address of each devices:
-						byte shortAddress[2];
-						memcpy(shortAddress, receivedData + SHORT_MAC_LEN + 2 + i * pollDeviceSize, 2);
-
-						// we test if the short address is our address
-						if (shortAddress[0] == _ownShortAddress[0] &&
-							shortAddress[1] == _ownShortAddress[1])
-						{
-							myDistantDevice->noteActivity(); // Poll is for us
+						myDistantDevice->noteActivity(); // Poll is for us
+						// a RANGE_COMPACT refers to us by this index
+						myDistantDevice->pollIndex = i;
+						myDistantDevice->resetContention();
 
-							// we grab the replytime which is for us
-							uint16_t replyTime = getReplyTimeOfIndex(i);
-							memcpy(&replyTime, receivedData + SHORT_MAC_LEN + 2 + 2 + i * pollDeviceSize, 2);
+						// our reply slot is given by our position in the list
+						uint16_t replyTime = getReplyTimeOfIndex(firstSlot + i, slotWidth);
 
-							// on POLL we (re-)start, so no protocol failure
-							_protocolFailed = false;
+						// on POLL we (re-)start, so no protocol failure
+						myDistantDevice->protocolFailed = false;
 
-							DW1000.getReceiveTimestamp(myDistantDevice->timePollReceived);
-							// we indicate our next receive message for our ranging protocol
-							_expectedMsgId = MessageType::RANGE;
-							transmitPollAck(myDistantDevice, replyTime);
-							noteActivity();
+						myDistantDevice->timePollReceived = _receivedFrame->timestamp;
+						// we indicate our next receive message for our ranging protocol
+						myDistantDevice->expectedMsgId = static_cast<byte>(MessageType::RANGE);
+						transmitPollAck(myDistantDevice, replyTime);
+						noteActivity();
 
-							return;
-						}
+						return;
 					}
-					// Remove mydistantdevice, non ci conosce, oppure send ranginginit
-					// removeNetworkDevices(myDistantDevice->getIndex());
+				}
+				// Remove mydistantdevice, non ci conosce, oppure send ranginginit
+				// removeNetworkDevices(myDistantDevice->getIndex());
 
-					int randomSlot = random(0, pollAckTimeSlots - numberDevices);
-					uint16_t replyTime = getReplyTimeOfIndex(randomSlot);
-					transmitRangingInit(replyTime);
+				// the tag leaves the POLL_ACK slots before the first polled one free for unknown anchors
+				int16_t slot = contentionSlot(myDistantDevice, firstSlot);
+				if (slot >= 0)
+				{
+					transmitRangingInit(getReplyTimeOfIndex(slot, slotWidth));
 				}
-				else if (messageType == MessageType::RANGE)
+			}
+			else if (messageType == MessageType::RANGE || messageType == MessageType::RANGE_COMPACT)
+			{
+				if (myDistantDevice == nullptr)
 				{
-					if (myDistantDevice == nullptr)
-					{
-						// we don't have the short address of the device in memory
-						m_log::log_err(LOG_DW1000, "Device not found");
-						return;
-					}
+					// we don't have the short address of the device in memory
+					m_log::log_err(LOG_DW1000, "Device not found");
+					return;
+				}
 
-					// we receive a RANGE which is a broadcast message
-					// we need to grab info about it
-					uint8_t numberDevices = 0;
-					memcpy(&numberDevices, receivedData + SHORT_MAC_LEN + 1, 1);
+				// we receive a RANGE which is a broadcast message
+				// we need to grab info about it
+				uint8_t numberDevices = 0;
+				memcpy(&numberDevices, receivedData + SHORT_MAC_LEN + 1, 1);
+				// RANGE_COMPACT entries carry our POLL index instead of our address
+				bool compact = messageType == MessageType::RANGE_COMPACT;
+				short entrySize = compact ? rangeCompactDeviceSize : rangeDeviceSize;
+
+				for (uint8_t i = 0; i < numberDevices; i++)
+				{
+					// we need to test if this value is for us:
+					byte *entry = receivedData + SHORT_MAC_LEN + 2 + i * entrySize;
 
-					for (uint8_t i = 0; i < numberDevices; i++)
+					// we test if the short address (or POLL index) is ours
+					if (compact ? entry[0] == myDistantDevice->pollIndex && entry[0] != POLL_INDEX_NONE
+								: entry[0] == _ownShortAddress[0] && entry[1] == _ownShortAddress[1])
 					{
-						// we need to test if this value is for us:
-						// we grab the mac address of each devices:
-						byte shortAddress[2];
-						memcpy(shortAddress, receivedData + SHORT_MAC_LEN + 2 + i * rangeDeviceSize, 2);
+						myDistantDevice->noteActivity();
 
-						// we test if the short address is our address
-						if (shortAddress[0] == _ownShortAddress[0] && shortAddress[1] == _ownShortAddress[1])
-						{
-							myDistantDevice->noteActivity();
+						// we grab the replytime which is for us
+						myDistantDevice->timeRangeReceived = _receivedFrame->timestamp;
+						noteActivity();
+						myDistantDevice->expectedMsgId = static_cast<byte>(MessageType::POLL);
 
-							// we grab the replytime which is for us
-							DW1000.getReceiveTimestamp(myDistantDevice->timeRangeReceived);
-							noteActivity();
-							_expectedMsgId = MessageType::POLL;
+						if (!myDistantDevice->protocolFailed)
+						{
 
-							if (!_protocolFailed)
+							if (compact)
 							{
+								uint32_t delta;
+								memcpy(&delta, entry + 1, 4);
+								myDistantDevice->timePollAckReceivedMinusPollSent.setTimestamp((int64_t)delta);
+								memcpy(&delta, entry + 5, 4);
+								myDistantDevice->timeRangeSentMinusPollAckReceived.setTimestamp((int64_t)delta);
+							}
+							else
+							{
+								myDistantDevice->timePollAckReceivedMinusPollSent.setTimestamp(entry + 2);
+								myDistantDevice->timeRangeSentMinusPollAckReceived.setTimestamp(entry + 7);
+							}
 
-								myDistantDevice->timePollAckReceivedMinusPollSent.setTimestamp(receivedData + SHORT_MAC_LEN + 4 + rangeDeviceSize * i);
-								myDistantDevice->timeRangeSentMinusPollAckReceived.setTimestamp(receivedData + SHORT_MAC_LEN + 9 + rangeDeviceSize * i);
-
-								// myDistantDevice->timePollSent.setTimestamp(receivedData + SHORT_MAC_LEN + 4 + 17 * i);
-								// myDistantDevice->timePollAckReceived.setTimestamp(receivedData + SHORT_MAC_LEN + 9 + 17 * i);
-								// myDistantDevice->timeRangeSent.setTimestamp(receivedData + SHORT_MAC_LEN + 14 + 17 * i);
+							// myDistantDevice->timePollSent.setTimestamp(receivedData + SHORT_MAC_LEN + 4 + 17 * i);
+							// myDistantDevice->timePollAckReceived.setTimestamp(receivedData + SHORT_MAC_LEN + 9 + 17 * i);
+							// myDistantDevice->timeRangeSent.setTimestamp(receivedData + SHORT_MAC_LEN + 14 + 17 * i);
 
-								// (re-)compute range as two-way ranging is done
-								DW1000Time myTOF;
-								computeRangeAsymmetric(myDistantDevice, &myTOF); // CHOSEN RANGING ALGORITHM
+							// POLL RX to RANGE RX on our clock is POLL TX to RANGE TX on the tag's
+							trackClockDrift(myDistantDevice, (myDistantDevice->timeRangeReceived - myDistantDevice->timePollReceived).wrap(),
+											(myDistantDevice->timePollAckReceivedMinusPollSent + myDistantDevice->timeRangeSentMinusPollAckReceived).wrap());
 
-								float distance = myTOF.getAsMeters();
+							// (re-)compute range as two-way ranging is done
+							DW1000Time myTOF;
+							computeRangeAsymmetric(myDistantDevice, &myTOF); // CHOSEN RANGING ALGORITHM
 
-								myDistantDevice->setRange(distance);
+							float distance = myTOF.getAsMeters();
 
-								myDistantDevice->setRXPower(DW1000.getReceivePower());
-								myDistantDevice->setFPPower(DW1000.getFirstPathPower());
-								myDistantDevice->setQuality(DW1000.getReceiveQuality());
+							myDistantDevice->setRange(distance);
+							myDistantDevice->rangeReportPending = ENABLE_POLL_ACK_RANGE_REPORT || ENABLE_TAG_SIDE_RANGING;
 
-								if (ENABLE_RANGE_REPORT)
-								{
-									uint16_t replyTime = getReplyTimeOfIndex(i);
+							myDistantDevice->setRXPower(_receivedFrame->rxPower);
+							myDistantDevice->setFPPower(_receivedFrame->fpPower);
+							myDistantDevice->setQuality(_receivedFrame->quality);
 
-									// we send the range to TAG
-									transmitRangeReport(myDistantDevice, replyTime);
-								}
+							if (ENABLE_RANGE_REPORT)
+							{
+								uint16_t replyTime = getReplyTimeOfIndex(i);
 
-								// we have finished our range computation. We send the corresponding handler
-								if (_handleNewRange != 0)
-								{
-									(*_handleNewRange)(myDistantDevice);
-								}
+								// we send the range to TAG
+								transmitRangeReport(myDistantDevice, replyTime);
 							}
-							// else
-							// {
-							// 	transmitRangeFailed(myDistantDevice);
-							// }
 
-							return;
+							// we have finished our range computation. We send the corresponding handler
+							if (_handleNewRange != 0)
+							{
+								(*_handleNewRange)(myDistantDevice);
+							}
 						}
+						// else
+						// {
+						// 	transmitRangeFailed(myDistantDevice);
+						// }
+
+						return;
 					}
 				}
 			}
-			else if (_type == BoardType::TAG)
+		}
+		else if (_type == BoardType::TAG)
+		{
+			if (myDistantDevice == nullptr)
+			{
+				// we don't have the short address of the device in memory
+				m_log::log_err(LOG_DW1000, "Device not found");
+				return;
+			}
+
+			myDistantDevice->noteActivity();
+			// get message and parse
+			if (messageType != _expectedMsgId)
 			{
-				if (myDistantDevice == nullptr)
+				// unexpected message, start over again
+				// not needed ?
+				return;
+				_expectedMsgId = MessageType::POLL_ACK;
+				return;
+			}
+			// we test if the short address is our address
+			if (receivedData[6] != _ownShortAddress[0] ||
+				receivedData[5] != _ownShortAddress[1])
+			{
+				return;
+			}
+
+			if (messageType == MessageType::POLL_ACK)
+			{
+				DW1000Time previousPollAckReceived = myDistantDevice->timePollAckReceived;
+				myDistantDevice->timePollAckReceived = _receivedFrame->timestamp;
+				if (_replyTimeOfLastPollAck != 0 && myDistantDevice->getShortAddress() != _addressOfExpectedLastPollAck)
 				{
-					// we don't have the short address of the device in memory
-					m_log::log_err(LOG_DW1000, "Device not found");
-					return;
+					rearmPollAckWindow(myDistantDevice);
 				}
-
+				// we note activity for our device:
 				myDistantDevice->noteActivity();
-				// get message and parse
-				if (messageType != _expectedMsgId)
+				myDistantDevice->hasSentPoolAck = true;
+				bool capabilities = receivedData[SHORT_MAC_LEN + 1] == POLL_ACK_CAPABILITY_MARKER;
+				myDistantDevice->compactRange = capabilities && (receivedData[SHORT_MAC_LEN + 2] & CAPABILITY_RANGE_COMPACT);
+				byte flags = capabilities ? receivedData[SHORT_MAC_LEN + 2] : 0;
+				bool rangeReported = false;
+
+				// a jump in RX power means we moved, other anchors may be in range now
+				float rxPowerStep = _receivedFrame->rxPower - myDistantDevice->getRXPower();
+				if (rxPowerStep > BLINK_RX_POWER_STEP || rxPowerStep < -BLINK_RX_POWER_STEP)
 				{
-					// unexpected message, start over again
-					// not needed ?
-					return;
-					_expectedMsgId = MessageType::POLL_ACK;
-					return;
+					shortenBlinkInterval(BLINK_INTERVAL_MIN);
+					myDistantDevice->setRXPower(_receivedFrame->rxPower);
 				}
-				// we test if the short address is our address
-				if (receivedData[6] != _ownShortAddress[0] ||
-					receivedData[5] != _ownShortAddress[1])
+				else
 				{
-					return;
+					myDistantDevice->setRXPower(0.75f * myDistantDevice->getRXPower() + 0.25f * _receivedFrame->rxPower);
 				}
+				myDistantDevice->setFPPower(0.75f * myDistantDevice->getFPPower() + 0.25f * _receivedFrame->fpPower);
+				myDistantDevice->setQuality(_receivedFrame->quality);
 
-				if (messageType == MessageType::POLL_ACK)
-				{
-					DW1000.getReceiveTimestamp(myDistantDevice->timePollAckReceived);
-					// we note activity for our device:
-					myDistantDevice->noteActivity();
-					myDistantDevice->hasSentPoolAck = true;
-
-					// Serial.println(DW1000.getReceivePower());
-					// Serial.println(DW1000.getFirstPathPower());
-					// Serial.println(DW1000.getReceiveQuality());
+				// the carrier integrator gives the anchor clock offset on every POLL_ACK
+				myDistantDevice->clockOffset = myDistantDevice->clockOffset == 0 ? _receivedFrame->clockOffset
+																				  : 0.75f * myDistantDevice->clockOffset + 0.25f * _receivedFrame->clockOffset;
 
-					// in the case the message come from our last device:
-					if (_replyTimeOfLastPollAck != 0 && myDistantDevice->getShortAddress() == _addressOfExpectedLastPollAck)
+				if (ENABLE_SS_TWR && (flags & CAPABILITY_TIMESTAMPS))
+				{
+					// single-sided: the anchor reply time measured by its clock, brought to ours
+					byte *timestamps = receivedData + SHORT_MAC_LEN + pollAckTimestampsOffset;
+					DW1000Time previousPollAckSent = myDistantDevice->timePollAckSent;
+					myDistantDevice->timePollReceived.setTimestamp(timestamps);
+					myDistantDevice->timePollAckSent.setTimestamp(timestamps + 5);
+					if (previousPollAckSent.getTimestamp() != 0)
 					{
-						m_log::log_vrb(LOG_DW1000_MSG, "RANGE LAST POLLACK");
-						transmitRange();
-
-						DEBUGRangeSent = millis();
-						m_log::log_vrb(LOG_DW1000_MSG, "MILLIS: %d", DEBUGRangeSent - DEBUGtimePollSent);
+						// from the last POLL_ACK to this one on both clocks
+						trackClockDrift(myDistantDevice, (myDistantDevice->timePollAckReceived - previousPollAckReceived).wrap(),
+										(myDistantDevice->timePollAckSent - previousPollAckSent).wrap());
+					}
+					DW1000Time myTOF;
+					computeRangeSingleSided(myDistantDevice, &myTOF);
+					myDistantDevice->setRange(myTOF.getAsMeters());
+					rangeReported = true;
+				}
+				else if (flags & CAPABILITY_TIMESTAMPS)
+				{
+					// our previous exchange is complete with the anchor's RANGE RX, we still have the
+					// anchor's POLL RX / POLL_ACK TX and our own differences of that exchange
+					byte *timestamps = receivedData + SHORT_MAC_LEN + pollAckTimestampsOffset;
+					if (flags & CAPABILITY_PREVIOUS_RANGE_RX)
+					{
+						myDistantDevice->timeRangeReceived.setTimestamp(timestamps + 10);
+						trackClockDrift(myDistantDevice, (myDistantDevice->timePollAckReceivedMinusPollSent + myDistantDevice->timeRangeSentMinusPollAckReceived).wrap(),
+										(myDistantDevice->timeRangeReceived - myDistantDevice->timePollReceived).wrap());
+						DW1000Time myTOF;
+						computeRangeAsymmetric(myDistantDevice, &myTOF);
+						myDistantDevice->setRange(myTOF.getAsMeters());
+						rangeReported = true;
 					}
+					myDistantDevice->timePollReceived.setTimestamp(timestamps);
+					myDistantDevice->timePollAckSent.setTimestamp(timestamps + 5);
 				}
-				else if (messageType == MessageType::RANGE_REPORT)
+				else if (flags & CAPABILITY_RANGE_REPORT)
 				{
+					// the anchor's range of our previous exchange
 					float curRange;
-					memcpy(&curRange, receivedData + 1 + SHORT_MAC_LEN, 4);
-					float curRXPower;
-					memcpy(&curRXPower, receivedData + 5 + SHORT_MAC_LEN, 4);
-
-					// we have a new range to save !
+					memcpy(&curRange, receivedData + SHORT_MAC_LEN + pollAckRangeOffset, 4);
 					myDistantDevice->setRange(curRange);
-					myDistantDevice->setRXPower(curRXPower);
+					rangeReported = true;
+				}
+				// the handler runs once the RANGE is scheduled
 
-					// We can call our handler !
-					// we have finished our range computation. We send the corresponding handler
-					if (_handleNewRange != 0)
-					{
-						(*_handleNewRange)(myDistantDevice);
-					}
+				// Serial.println(_receivedFrame->rxPower);
+				// Serial.println(_receivedFrame->fpPower);
+				// Serial.println(_receivedFrame->quality);
+
+				// in the case the message come from our last device:
+				if (_replyTimeOfLastPollAck != 0 && myDistantDevice->getShortAddress() == _addressOfExpectedLastPollAck)
+				{
+					m_log::log_vrb(LOG_DW1000_MSG, "RANGE LAST POLLACK");
+					transmitRange(&myDistantDevice->timePollAckReceived);
+
+					DEBUGRangeSent = millis();
+					m_log::log_vrb(LOG_DW1000_MSG, "MILLIS: %d", DEBUGRangeSent - DEBUGtimePollSent);
 				}
-				else if (messageType == MessageType::RANGE_FAILED)
+
+				if (rangeReported && isSurveying())
 				{
-					// not needed as we have a timer;
-					return;
-					_expectedMsgId = MessageType::POLL_ACK;
+					addSurveyRange(myDistantDevice);
+				}
+				if (rangeReported && _handleNewRange != 0)
+				{
+					(*_handleNewRange)(myDistantDevice);
+				}
+			}
+			else if (messageType == MessageType::RANGE_REPORT)
+			{
+				float curRange;
+				memcpy(&curRange, receivedData + 1 + SHORT_MAC_LEN, 4);
+				float curRXPower;
+				memcpy(&curRXPower, receivedData + 5 + SHORT_MAC_LEN, 4);
+
+				// we have a new range to save !
+				myDistantDevice->setRange(curRange);
+				myDistantDevice->setRXPower(curRXPower);
+				if (isSurveying())
+				{
+					addSurveyRange(myDistantDevice);
+				}
+
+				// We can call our handler !
+				// we have finished our range computation. We send the corresponding handler
+				if (_handleNewRange != 0)
+				{
+					(*_handleNewRange)(myDistantDevice);
 				}
 			}
+			else if (messageType == MessageType::RANGE_FAILED)
+			{
+				// not needed as we have a timer;
+				return;
+				_expectedMsgId = MessageType::POLL_ACK;
+			}
 		}
 	}
 }
@@ -780,8 +1126,44 @@ void DW1000RangingClass::handleSent()
 	_sentAck = true;
 }
 
+void DW1000RangingClass::rearmPollAckWindow(DW1000Device *myDistantDevice)
+{
+	// The chip may stop the frame wait timer on a good frame, or restart it when RXAUTR enables
+	// the receiver again. Either way it gets what is left of the window, on the chip clock from
+	// the POLL TX. The receiver stays on, the POLL_ACK in the other buffer is not lost.
+	float elapsed = (myDistantDevice->timePollAckReceived - myDistantDevice->timePollSent).wrap().getAsMicroSeconds();
+	uint32_t left = elapsed < _pollAckWindowLength ? _pollAckWindowLength - (uint32_t)elapsed : 1;
+	DW1000.setReceiveFrameWaitTimeout(left);
+}
+
+void DW1000RangingClass::handleReceiveTimeout()
+{
+	// the receiver is off now, it is restarted without timeout
+	DW1000.setReceiveFrameWaitTimeout(0);
+	_pollAckWindowClosed = true;
+}
+
 void DW1000RangingClass::handleReceived()
 {
+	// called once per filled RX buffer, before the chip hands over the other one:
+	// data, timestamp and diagnostics of this buffer have to be captured now
+	if ((uint8_t)(_receivedFramesIn - _receivedFramesOut) >= RECEIVE_QUEUE_SIZE)
+	{
+		_receivedFramesDropped++;
+		return;
+	}
+	ReceivedFrame &frame = _receivedFrames[_receivedFramesIn % RECEIVE_QUEUE_SIZE];
+	// frames carry only their content, the fields a shorter frame does not have read as 0
+	uint16_t length = DW1000.getDataLength();
+	frame.length = length < LEN_DATA ? length : LEN_DATA;
+	DW1000.getData(frame.data, frame.length);
+	memset(frame.data + frame.length, 0, LEN_DATA - frame.length);
+	DW1000.getReceiveTimestamp(frame.timestamp);
+	frame.rxPower = DW1000.getReceivePower();
+	frame.fpPower = DW1000.getFirstPathPower();
+	frame.quality = DW1000.getReceiveQuality();
+	frame.clockOffset = DW1000.getClockOffset();
+	_receivedFramesIn++;
 	// status change on received success
 	_receivedAck = true;
 }
@@ -799,7 +1181,10 @@ void DW1000RangingClass::resetInactive()
 	{
 		if (_type == BoardType::ANCHOR)
 		{
-			_expectedMsgId = MessageType::POLL;
+			for (uint8_t i = 0; i < _networkDevicesNumber; i++)
+			{
+				_networkDevices[i].expectedMsgId = static_cast<byte>(MessageType::POLL);
+			}
 			receiver();
 		}
 		noteActivity();
@@ -808,14 +1193,54 @@ void DW1000RangingClass::resetInactive()
 
 void DW1000RangingClass::timerTick()
 {
+	if (_type == BoardType::TAG && _superframeSynchronized)
+	{
+		// the BEACON paces the tag, see superframeTick()
+		return;
+	}
+	rangingCycle();
+}
+
+void DW1000RangingClass::rangingCycle()
+{
+	if (_type == BoardType::TAG)
+	{
+		_rangingCycles++;
+		if (isSurveying() && --_surveyCyclesLeft == 0)
+		{
+			endSurvey();
+			return;
+		}
+		// with rare BLINKs the anchors that stopped answering are noticed here
+		uint8_t devicesNumber = _networkDevicesNumber;
+		checkForInactiveDevices();
+		if (_networkDevicesNumber < devicesNumber || _networkDevicesNumber == 0)
+		{
+			shortenBlinkInterval(BLINK_INTERVAL_MIN);
+		}
+	}
+
+	if (_tdoa && _type == BoardType::TAG)
+	{
+		// the anchors do the rest
+		transmitBlink();
+		_blinksSent++;
+		return;
+	}
+
 	if (counterForBlink == 0)
 	{
 		if (_type == BoardType::TAG)
 		{
+			adaptBlinkInterval();
 			transmitBlink();
+			_blinksSent++;
+		}
+		else
+		{
+			// check for inactive devices if we are an ANCHOR
+			checkForInactiveDevices();
 		}
-		// check for inactive devices if we are a TAG or ANCHOR
-		checkForInactiveDevices();
 	}
 	else
 	{
@@ -826,7 +1251,35 @@ void DW1000RangingClass::timerTick()
 			transmitPoll();
 		}
 	}
-	counterForBlink = (counterForBlink + 1) % BLINK_INTERVAL;
+	counterForBlink = (counterForBlink + 1) % _blinkInterval;
+}
+
+void DW1000RangingClass::adaptBlinkInterval()
+{
+	// called before each BLINK: the last one found nothing new, so the anchor set is stable
+	if (_blinkFoundDevice || _networkDevicesNumber == 0)
+	{
+		_blinkInterval = BLINK_INTERVAL_MIN;
+	}
+	else if (_blinkInterval < BLINK_INTERVAL_MAX)
+	{
+		_blinkInterval = _blinkInterval * 2 < BLINK_INTERVAL_MAX ? _blinkInterval * 2 : BLINK_INTERVAL_MAX;
+	}
+	_blinkFoundDevice = false;
+}
+
+void DW1000RangingClass::shortenBlinkInterval(uint8_t blinkInterval)
+{
+	if (_blinkInterval > blinkInterval)
+	{
+		m_log::log_vrb(LOG_DW1000, "Blink interval %d", blinkInterval);
+		_blinkInterval = blinkInterval;
+	}
+	// blink within the new interval
+	if (counterForBlink >= _blinkInterval)
+	{
+		counterForBlink = 0;
+	}
 }
 
 void DW1000RangingClass::copyShortAddress(byte to[], byte from[])
@@ -845,36 +1298,122 @@ void DW1000RangingClass::transmitInit()
 	DW1000.setDefaults();
 }
 
-void DW1000RangingClass::transmit(byte datas[])
+void DW1000RangingClass::transmit(byte datas[], uint16_t length)
 {
-	DW1000.setData(datas, LEN_DATA);
+	DW1000.setData(datas, length);
 	DW1000.startTransmit();
 }
 
-void DW1000RangingClass::transmit(byte datas[], DW1000Time time)
+void DW1000RangingClass::transmit(byte datas[], uint16_t length, DW1000Time time)
 {
 	DW1000.setDelay(time);
-	DW1000.setData(datas, LEN_DATA);
+	DW1000.setData(datas, length);
 	DW1000.startTransmit();
 }
 
-void DW1000RangingClass::transmitBlink()
+DW1000Time DW1000RangingClass::transmit(byte datas[], uint16_t length, DW1000Time time, const DW1000Time &reference)
 {
-	// we need to set our timerDelay:
-	_timerDelay = _rangeInterval + (uint16_t)(10 * 3 * DEFAULT_REPLY_DELAY_TIME / 1000);
+	DW1000Time futureTime = setReplyDelay(reference, time);
+	DW1000.setData(datas, length);
+	DW1000.startTransmit();
+	return futureTime;
+}
+
+DW1000Time DW1000RangingClass::setReplyDelay(const DW1000Time &reference, const DW1000Time &delay)
+{
+	DW1000Time futureTime;
+	if (!DW1000.setDelayFrom(reference, delay, futureTime))
+	{
+		// too slow for the slot, better late than waiting for the counter wrap
+		_lateReplies++;
+		m_log::log_vrb(LOG_DW1000, "Late reply, min turnaround %d us", getMinimumReplyDelayTime());
+		futureTime = DW1000.setDelay(delay);
+	}
+	return futureTime;
+}
+
+void DW1000RangingClass::setReplyDelayTime(uint16_t replyDelayTime)
+{
+	// the reply slots and timer delays are 16 bit microseconds computed from this value
+	if (replyDelayTime > DEFAULT_REPLY_DELAY_TIME)
+	{
+		replyDelayTime = DEFAULT_REPLY_DELAY_TIME;
+	}
+	if (replyDelayTime < getMinimumReplyDelayTime())
+	{
+		m_log::log_err(LOG_DW1000, "Reply delay %d us below measured turnaround %d us", replyDelayTime, getMinimumReplyDelayTime());
+	}
+	_replyDelayTime = replyDelayTime;
+	// the slowest anchor slot has to stay within 16 bit
+	setAnchorsPerRound(_anchorsPerRound);
+}
+
+uint8_t DW1000RangingClass::getMaxAnchorsPerRound()
+{
+	// the last POLL_ACK slot (2 * slots - 1) * replyDelay has to fit in 16 bit microseconds
+	uint16_t slots = (65535 / _replyDelayTime + 1) / 2;
+	uint16_t anchors = slots > POLL_FREE_SLOTS ? slots - POLL_FREE_SLOTS : 1;
+	return anchors < RANGING_MAX_ANCHORS ? anchors : RANGING_MAX_ANCHORS;
+}
+
+void DW1000RangingClass::setAnchorsPerRound(uint8_t anchors)
+{
+	if (anchors > getMaxAnchorsPerRound())
+	{
+		m_log::log_err(LOG_DW1000, "%d anchors per round do not fit, using %d", anchors, getMaxAnchorsPerRound());
+		anchors = getMaxAnchorsPerRound();
+	}
+	if (anchors == 0)
+	{
+		anchors = 1;
+	}
+	_anchorsPerRound = anchors;
+	_pollAckTimeSlots = anchors + POLL_FREE_SLOTS;
+}
+
+uint16_t DW1000RangingClass::getMinimumReplyDelayTime()
+{
+	return (uint16_t)DW1000.getMinimumTurnaroundTime().getAsMicroSeconds() + 1;
+}
+
+uint32_t DW1000RangingClass::getDriftLimitedReplyDelayTime(float maxError)
+{
+	float uncertainty = 0;
+	for (uint8_t i = 0; i < _networkDevicesNumber; i++)
+	{
+		float deviceUncertainty = _networkDevices[i].hasClockDrift() ? _networkDevices[i].getClockDriftUncertainty() : CLOCK_DRIFT_MAX;
+		if (deviceUncertainty > uncertainty)
+		{
+			uncertainty = deviceUncertainty;
+		}
+	}
+	if (uncertainty == 0)
+	{
+		return UINT32_MAX;
+	}
+	// error = reply * uncertainty / 2 as a distance
+	return (uint32_t)(2 * maxError / (uncertainty * DW1000Time::TIME_RES_INV * DW1000Time::DISTANCE_OF_RADIO));
+}
+
+void DW1000RangingClass::transmitBlink()
+{
+	// we need to set our timerDelay:
+	_timerDelay = _rangeInterval + (uint16_t)(10 * 3 * (uint32_t)_replyDelayTime / 1000);
 
 	transmitInit();
 	_globalMac.generateBlinkFrame(sentData, _ownShortAddress);
 
-	sentData[BLINK_MAC_LEN] = _networkDevicesNumber;
+	memset(sentData + BLINK_MAC_LEN, 0, BLINK_FILTER_LEN);
 	for (uint8_t i = 0; i < _networkDevicesNumber; i++)
 	{
-		memcpy(sentData + BLINK_MAC_LEN + 1 + i * 2, _networkDevices[i].getByteShortAddress(), 2);
+		addToBlinkFilter(sentData + BLINK_MAC_LEN, _networkDevices[i].getByteShortAddress());
 	}
-	transmit(sentData);
-
-	byte shortBroadcast[2] = {0xFF, 0xFF};
-	copyShortAddress(_lastSentToShortAddress, shortBroadcast);
+	sentData[BLINK_MAC_LEN + BLINK_FILTER_LEN] = _zone;
+	uint16_t length = BLINK_MAC_LEN + BLINK_FILTER_LEN + 1;
+	if (_transmitInSlot)
+		transmitInSlot(sentData, length);
+	else
+		transmit(sentData, length);
 }
 
 void DW1000RangingClass::transmitRangingInit(u_int16_t delay)
@@ -885,11 +1424,27 @@ void DW1000RangingClass::transmitRangingInit(u_int16_t delay)
 	_globalMac.generateShortMACFrame(sentData, _ownShortAddress, shortBroadcast);
 	// we define the function code
 	sentData[SHORT_MAC_LEN] = static_cast<byte>(MessageType::RANGING_INIT);
+	sentData[SHORT_MAC_LEN + 1] = 0;
+	uint16_t length = SHORT_MAC_LEN + 2;
+	if (_hasPosition)
+	{
+		sentData[SHORT_MAC_LEN + 1] |= RANGING_INIT_POSITION;
+		memcpy(sentData + length, _position, sizeof(_position));
+		length += sizeof(_position);
+	}
+	if (_zone != ZONE_NONE)
+	{
+		byte *zone = sentData + length;
+		sentData[SHORT_MAC_LEN + 1] |= RANGING_INIT_ZONE;
+		zone[0] = _zone;
+		zone[1] = _zoneNeighbourCount;
+		memcpy(zone + 2, _zoneNeighbours, _zoneNeighbourCount);
+		length += 2 + _zoneNeighbourCount;
+	}
 
-	copyShortAddress(_lastSentToShortAddress, shortBroadcast);
-
+	// always an answer (to a BLINK or POLL), the slot starts at its RX timestamp
 	DW1000Time deltaTime = DW1000Time(delay, DW1000Time::MICROSECONDS);
-	transmit(sentData, deltaTime);
+	transmit(sentData, length, deltaTime, _receivedFrame->timestamp);
 }
 
 void DW1000RangingClass::transmitPoll()
@@ -897,9 +1452,10 @@ void DW1000RangingClass::transmitPoll()
 	transmitInit();
 
 	// we need to set our timerDelay:
-	_timerDelay = _rangeInterval + (uint16_t)(pollAckTimeSlots * 3 * DEFAULT_REPLY_DELAY_TIME / 1000); // TODO meglio fermare il timer forse
+	_timerDelay = _rangeInterval + (uint16_t)(_pollAckTimeSlots * 3 * (uint32_t)_replyDelayTime / 1000); // TODO meglio fermare il timer forse
 
-	uint8_t devicesCount = _networkDevicesNumber < devicePerPollTransmit ? _networkDevicesNumber : devicePerPollTransmit;
+	uint8_t devicesCount = _networkDevicesNumber < _anchorsPerRound ? _networkDevicesNumber : _anchorsPerRound;
+	selectPolledDevices();
 
 	byte shortBroadcast[2] = {0xFF, 0xFF};
 	_globalMac.generateShortMACFrame(sentData, _ownShortAddress, shortBroadcast);
@@ -907,32 +1463,56 @@ void DW1000RangingClass::transmitPoll()
 	// we enter the number of devices
 	sentData[SHORT_MAC_LEN + 1] = devicesCount;
 
-	uint8_t freeSlots = pollAckTimeSlots - devicesCount;
+	// the anchors derive their slot from these and their position in the list
+	uint8_t freeSlots = _pollAckTimeSlots - devicesCount;
+	memcpy(sentData + SHORT_MAC_LEN + 2, &_replyDelayTime, 2);
+	sentData[SHORT_MAC_LEN + 4] = freeSlots;
 
-	for (uint8_t i = 0; i < devicesCount; i++)
+	uint8_t i = 0;
+	for (uint8_t j = 0; j < _networkDevicesNumber; j++)
 	{
+		DW1000Device *device = &_networkDevices[j];
+		device->pollIndex = POLL_INDEX_NONE;
+		if (!device->selected || i >= devicesCount)
+			continue;
+		device->pollIndex = i;
+
 		// each devices have a different reply delay time.
-		_networkDevices[i].setReplyTime(getReplyTimeOfIndex(i+freeSlots));
+		device->setReplyTime(getReplyTimeOfIndex(i+freeSlots));
 
 		// we write the short address of our device:
-		memcpy(sentData + SHORT_MAC_LEN + 2 + i * pollDeviceSize, _networkDevices[i].getByteShortAddress(), 2);
-
-		// we add the replyTime
-		uint16_t replyTime = _networkDevices[i].getReplyTime();
-		memcpy(sentData + SHORT_MAC_LEN + 2 + 2 + i * pollDeviceSize, &replyTime, 2);
+		memcpy(sentData + SHORT_MAC_LEN + pollHeaderSize + i * pollDeviceSize, device->getByteShortAddress(), 2);
 
-		_addressOfExpectedLastPollAck = _networkDevices[i].getShortAddress();
+		_addressOfExpectedLastPollAck = device->getShortAddress();
+		i++;
 	}
 
 	// if (_networkDevicesNumber > 0)
 	// 	_replyTimeOfLastPollAck = getReplyTimeOfIndex(_networkDevicesNumber - 1) / 1000;
-	_replyTimeOfLastPollAck = getReplyTimeOfIndex(pollAckTimeSlots - 1) / 1000;
+	_replyTimeOfLastPollAck = getReplyTimeOfIndex(_pollAckTimeSlots - 1) / 1000;
+	// the last POLL_ACK is received about a frame duration after its slot
+	_pollAckWindowLength = getReplyTimeOfIndex(_pollAckTimeSlots - 1) + _replyDelayTime / 2;
+	_pollAckWindowClosed = false;
+	// armed once for the whole window, the receiver is enabled right after the POLL and is
+	// not restarted between the POLL_ACKs, so none of them is dropped
+	DW1000.setReceiveFrameWaitTimeout(_pollAckWindowLength);
 
 	_timeOfLastPollSent = millis();
 
-	copyShortAddress(_lastSentToShortAddress, shortBroadcast);
-
-	transmit(sentData);
+	uint16_t length = SHORT_MAC_LEN + pollHeaderSize + devicesCount * pollDeviceSize;
+	if (_transmitInSlot)
+	{
+		if (!transmitInSlot(sentData, length))
+		{
+			// no POLL, no POLL_ACK to wait for
+			_replyTimeOfLastPollAck = 0;
+			_addressOfExpectedLastPollAck = 0;
+		}
+	}
+	else
+	{
+		transmit(sentData, length);
+	}
 }
 
 void DW1000RangingClass::transmitPollAck(DW1000Device *myDistantDevice, u_int16_t delay)
@@ -940,13 +1520,46 @@ void DW1000RangingClass::transmitPollAck(DW1000Device *myDistantDevice, u_int16_
 	transmitInit();
 	_globalMac.generateShortMACFrame(sentData, _ownShortAddress, myDistantDevice->getByteShortAddress());
 	sentData[SHORT_MAC_LEN] = static_cast<byte>(MessageType::POLL_ACK);
+	// we tell the tag which RANGE formats we understand
+	sentData[SHORT_MAC_LEN + 1] = POLL_ACK_CAPABILITY_MARKER;
+	sentData[SHORT_MAC_LEN + 2] = CAPABILITY_RANGE_COMPACT;
 	// delay the same amount as ranging tag
 	DW1000Time deltaTime = DW1000Time(delay, DW1000Time::MICROSECONDS);
-	copyShortAddress(_lastSentToShortAddress, myDistantDevice->getByteShortAddress());
-	transmit(sentData, deltaTime);
+	// the send time is known now, so it is kept per tag even if another tag's POLL follows
+	DW1000Time timePollAckSent = setReplyDelay(myDistantDevice->timePollReceived, deltaTime);
+	uint16_t length = SHORT_MAC_LEN + pollAckRangeOffset;
+
+	if (ENABLE_TAG_SIDE_RANGING || ENABLE_SS_TWR)
+	{
+		// the tag stamps the other three itself
+		byte *timestamps = sentData + SHORT_MAC_LEN + pollAckTimestampsOffset;
+		sentData[SHORT_MAC_LEN + 2] |= CAPABILITY_TIMESTAMPS;
+		myDistantDevice->timePollReceived.getTimestamp(timestamps);
+		timePollAckSent.getTimestamp(timestamps + 5);
+		length = SHORT_MAC_LEN + pollAckTimestampsOffset + 10;
+		if (myDistantDevice->rangeReportPending)
+		{
+			sentData[SHORT_MAC_LEN + 2] |= CAPABILITY_PREVIOUS_RANGE_RX;
+			myDistantDevice->timeRangeReceived.getTimestamp(timestamps + 10);
+			length += 5;
+		}
+	}
+	else if (myDistantDevice->rangeReportPending)
+	{
+		// range of the previous exchange, this saves the RANGE_REPORT slot
+		float curRange = myDistantDevice->getRange();
+		sentData[SHORT_MAC_LEN + 2] |= CAPABILITY_RANGE_REPORT;
+		memcpy(sentData + SHORT_MAC_LEN + pollAckRangeOffset, &curRange, 4);
+		length = SHORT_MAC_LEN + pollAckRangeOffset + 4;
+	}
+	myDistantDevice->rangeReportPending = false;
+	myDistantDevice->timePollAckSent = timePollAckSent;
+
+	DW1000.setData(sentData, length);
+	DW1000.startTransmit();
 }
 
-void DW1000RangingClass::transmitRange()
+void DW1000RangingClass::transmitRange(const DW1000Time *reference)
 {
 	// Disable range send on timeout
 	_replyTimeOfLastPollAck = 0;
@@ -954,12 +1567,11 @@ void DW1000RangingClass::transmitRange()
 	_timeOfLastPollSent = 0;
 
 	_expectedMsgId = ENABLE_RANGE_REPORT ? MessageType::RANGE_REPORT : MessageType::POLL_ACK;
-
-	constexpr uint8_t devicePerTransmit = 6;
+	_pollAckWindowClosed = false;
 
 	uint8_t devicesCount = 0;
-	DW1000Device *devices[devicePerTransmit];
-	for (uint8_t i = 0; i < _networkDevicesNumber && devicesCount < devicePerTransmit; i++)
+	DW1000Device *devices[RANGING_MAX_ANCHORS];
+	for (uint8_t i = 0; i < _networkDevicesNumber && devicesCount < RANGING_MAX_ANCHORS; i++)
 	{
 		if (_networkDevices[i].hasSentPoolAck)
 		{
@@ -967,20 +1579,53 @@ void DW1000RangingClass::transmitRange()
 		}
 	}
 
+	// an anchor did not answer our POLL, look for others sooner
+	uint8_t polledCount = _networkDevicesNumber < _anchorsPerRound ? _networkDevicesNumber : _anchorsPerRound;
+	if (devicesCount < polledCount)
+	{
+		shortenBlinkInterval(BLINK_INTERVAL);
+	}
+	for (uint8_t i = 0; i < _networkDevicesNumber; i++)
+	{
+		// only the anchors in the POLL had a chance to answer
+		if (_networkDevices[i].pollIndex != POLL_INDEX_NONE)
+		{
+			_networkDevices[i].successRate = 0.8f * _networkDevices[i].successRate + (_networkDevices[i].hasSentPoolAck ? 0.2f : 0.0f);
+		}
+	}
+
 	// we need to set our timerDelay:
-	_timerDelay = _rangeInterval + (uint16_t)(devicesCount * 3 * DEFAULT_REPLY_DELAY_TIME / 1000);
+	_timerDelay = _rangeInterval + (uint16_t)(devicesCount * 3 * (uint32_t)_replyDelayTime / 1000);
+
+	if (ENABLE_SS_TWR)
+	{
+		// the ranges came with the POLL_ACKs, the cycle ends here without RANGE
+		DW1000.setReceiveFrameWaitTimeout(0);
+		receiver();
+		return;
+	}
 
 	transmitInit();
+	// the receiver is off now, close the POLL_ACK window if still armed
+	DW1000.setReceiveFrameWaitTimeout(0);
+
+	// the compact format only if every anchor in this RANGE announced it
+	bool compact = devicesCount > 0;
+	for (uint8_t i = 0; i < devicesCount; i++)
+	{
+		compact = compact && devices[i]->compactRange && devices[i]->pollIndex != POLL_INDEX_NONE;
+	}
 
 	byte shortBroadcast[2] = {0xFF, 0xFF};
 	_globalMac.generateShortMACFrame(sentData, _ownShortAddress, shortBroadcast);
-	sentData[SHORT_MAC_LEN] = static_cast<byte>(MessageType::RANGE);
+	sentData[SHORT_MAC_LEN] = static_cast<byte>(compact ? MessageType::RANGE_COMPACT : MessageType::RANGE);
 	// we enter the number of devices
 	sentData[SHORT_MAC_LEN + 1] = devicesCount;
 
-	// delay sending the message and remember expected future sent timestamp
-	DW1000Time deltaTime = DW1000Time(DEFAULT_REPLY_DELAY_TIME, DW1000Time::MICROSECONDS);
-	DW1000Time timeRangeSent = DW1000.setDelay(deltaTime);
+	// delay sending the message and remember expected future sent timestamp,
+	// after the last POLL_ACK we reply from its RX timestamp, on timeout from now
+	DW1000Time deltaTime = DW1000Time(_replyDelayTime, DW1000Time::MICROSECONDS);
+	DW1000Time timeRangeSent = reference != nullptr ? setReplyDelay(*reference, deltaTime) : DW1000.setDelay(deltaTime);
 
 	for (uint8_t i = 0; i < devicesCount; i++)
 	{
@@ -988,20 +1633,31 @@ void DW1000RangingClass::transmitRange()
 			// each devices have a different reply delay time.
 			devices[i]->setReplyTime(getReplyTimeOfIndex(i));
 
-		// we write the short address of our device:
-		memcpy(sentData + SHORT_MAC_LEN + 2 + rangeDeviceSize * i, devices[i]->getByteShortAddress(), 2);
-
 		// we get the device which correspond to the message which was sent (need to be filtered by MAC address)
 		devices[i]->timeRangeSent = timeRangeSent;
 		devices[i]->timePollAckReceivedMinusPollSent = devices[i]->timePollAckReceived - devices[i]->timePollSent;
 		devices[i]->timeRangeSentMinusPollAckReceived = devices[i]->timeRangeSent - devices[i]->timePollAckReceived;
-		devices[i]->timePollAckReceivedMinusPollSent.getTimestamp(sentData + SHORT_MAC_LEN + 4 + rangeDeviceSize * i);
-		devices[i]->timeRangeSentMinusPollAckReceived.getTimestamp(sentData + SHORT_MAC_LEN + 9 + rangeDeviceSize * i);
-	}
 
-	copyShortAddress(_lastSentToShortAddress, shortBroadcast);
+		if (compact)
+		{
+			// both differences are a few reply windows, far below the 67 ms of 32 bit
+			byte *entry = sentData + SHORT_MAC_LEN + 2 + rangeCompactDeviceSize * i;
+			entry[0] = devices[i]->pollIndex;
+			uint32_t delta = (uint32_t)devices[i]->timePollAckReceivedMinusPollSent.wrap().getTimestamp();
+			memcpy(entry + 1, &delta, 4);
+			delta = (uint32_t)devices[i]->timeRangeSentMinusPollAckReceived.wrap().getTimestamp();
+			memcpy(entry + 5, &delta, 4);
+		}
+		else
+		{
+			// we write the short address of our device:
+			memcpy(sentData + SHORT_MAC_LEN + 2 + rangeDeviceSize * i, devices[i]->getByteShortAddress(), 2);
+			devices[i]->timePollAckReceivedMinusPollSent.getTimestamp(sentData + SHORT_MAC_LEN + 4 + rangeDeviceSize * i);
+			devices[i]->timeRangeSentMinusPollAckReceived.getTimestamp(sentData + SHORT_MAC_LEN + 9 + rangeDeviceSize * i);
+		}
+	}
 
-	transmit(sentData);
+	transmit(sentData, SHORT_MAC_LEN + 2 + devicesCount * (compact ? rangeCompactDeviceSize : rangeDeviceSize));
 }
 
 void DW1000RangingClass::transmitRangeReport(DW1000Device *myDistantDevice, u_int16_t delay)
@@ -1015,8 +1671,7 @@ void DW1000RangingClass::transmitRangeReport(DW1000Device *myDistantDevice, u_in
 	// We add the Range and then the RXPower
 	memcpy(sentData + 1 + SHORT_MAC_LEN, &curRange, 4);
 	memcpy(sentData + 5 + SHORT_MAC_LEN, &curRXPower, 4);
-	copyShortAddress(_lastSentToShortAddress, myDistantDevice->getByteShortAddress());
-	transmit(sentData, DW1000Time(delay, DW1000Time::MICROSECONDS));
+	transmit(sentData, SHORT_MAC_LEN + 9, DW1000Time(delay, DW1000Time::MICROSECONDS), myDistantDevice->timeRangeReceived);
 }
 
 void DW1000RangingClass::transmitRangeFailed(DW1000Device *myDistantDevice)
@@ -1025,8 +1680,255 @@ void DW1000RangingClass::transmitRangeFailed(DW1000Device *myDistantDevice)
 	_globalMac.generateShortMACFrame(sentData, _ownShortAddress, myDistantDevice->getByteShortAddress());
 	sentData[SHORT_MAC_LEN] = static_cast<byte>(MessageType::RANGE_FAILED);
 
-	copyShortAddress(_lastSentToShortAddress, myDistantDevice->getByteShortAddress());
-	transmit(sentData);
+	transmit(sentData, SHORT_MAC_LEN + 1);
+}
+
+/* ###########################################################################
+ * #### TDMA superframe ######################################################
+ * ########################################################################### */
+
+uint32_t DW1000RangingClass::getCycleAirtime()
+{
+	// POLL, POLL_ACK window and delayed RANGE with its airtime
+	uint32_t pollCycle = getReplyTimeOfIndex(_pollAckTimeSlots - 1) + _replyDelayTime / 2 + 2 * (uint32_t)_replyDelayTime;
+	// BLINK and the RANGING_INIT reply slots
+	uint32_t blinkCycle = (RANGING_INIT_SLOTS + 1) * (5 * (uint32_t)_replyDelayTime / 2);
+	return (pollCycle > blinkCycle ? pollCycle : blinkCycle) + SUPERFRAME_GUARD_TIME;
+}
+
+void DW1000RangingClass::startSuperframeCoordinator()
+{
+	_superframeSlotDuration = getCycleAirtime();
+	// as many slots as fit in the range interval, one is the BEACON/contention slot
+	uint32_t slots = (uint32_t)_rangeInterval * 1000 / _superframeSlotDuration;
+	slots = slots > 1 ? slots - 1 : 1;
+	_superframeSlotCount = slots < SUPERFRAME_MAX_SLOTS ? slots : SUPERFRAME_MAX_SLOTS;
+	memset(_superframeSlots, 0xFF, sizeof(_superframeSlots));
+	_superframeCoordinator = true;
+	// first BEACON on the next loop()
+	_lastBeaconTime = millis() - getSuperframePeriod() / 1000;
+
+	m_log::log_inf(LOG_DW1000, "Superframe: %d slots of %d us", _superframeSlotCount, _superframeSlotDuration);
+}
+
+void DW1000RangingClass::assignSuperframeSlot(byte shortAddress[])
+{
+	int16_t freeSlot = -1;
+	for (uint8_t i = 0; i < _superframeSlotCount; i++)
+	{
+		if (_superframeSlots[i][0] == shortAddress[0] && _superframeSlots[i][1] == shortAddress[1])
+			return; // already has a slot
+		if (freeSlot < 0 && _superframeSlots[i][0] == 0xFF && _superframeSlots[i][1] == 0xFF)
+			freeSlot = i;
+	}
+	if (freeSlot < 0)
+	{
+		m_log::log_err(LOG_DW1000, "Superframe full");
+		return;
+	}
+	copyShortAddress(_superframeSlots[freeSlot], shortAddress);
+}
+
+void DW1000RangingClass::transmitBeacon()
+{
+	_lastBeaconTime = millis();
+
+	// free the slots of tags that went inactive
+	for (uint8_t i = 0; i < _superframeSlotCount; i++)
+	{
+		if ((_superframeSlots[i][0] != 0xFF || _superframeSlots[i][1] != 0xFF) && searchDistantDevice(_superframeSlots[i]) == nullptr)
+		{
+			memset(_superframeSlots[i], 0xFF, 2);
+		}
+	}
+
+	transmitInit();
+	byte shortBroadcast[2] = {0xFF, 0xFF};
+	_globalMac.generateShortMACFrame(sentData, _ownShortAddress, shortBroadcast);
+	sentData[SHORT_MAC_LEN] = static_cast<byte>(MessageType::BEACON);
+	sentData[SHORT_MAC_LEN + 1] = _superframeSlotCount;
+	memcpy(sentData + SHORT_MAC_LEN + 2, &_superframeSlotDuration, 4);
+	memcpy(sentData + SHORT_MAC_LEN + 6, _superframeSlots, _superframeSlotCount * 2);
+
+	transmit(sentData, SHORT_MAC_LEN + 6 + _superframeSlotCount * 2);
+}
+
+void DW1000RangingClass::handleBeacon()
+{
+	uint8_t slotCount = receivedData[SHORT_MAC_LEN + 1];
+	if (slotCount == 0 || slotCount > SUPERFRAME_MAX_SLOTS)
+		return;
+	_superframeSlotCount = slotCount;
+	memcpy(&_superframeSlotDuration, receivedData + SHORT_MAC_LEN + 2, 4);
+
+	_superframeSlot = SUPERFRAME_NO_SLOT;
+	for (uint8_t i = 0; i < slotCount; i++)
+	{
+		const byte *slotAddress = receivedData + SHORT_MAC_LEN + 6 + i * 2;
+		if (slotAddress[0] == _ownShortAddress[0] && slotAddress[1] == _ownShortAddress[1])
+			_superframeSlot = i;
+	}
+
+	// all slots are relative to the BEACON RX timestamp, the local time of it is only
+	// needed to know when to program the delayed transmission
+	_beaconReceived = _receivedFrame->timestamp;
+	DW1000Time now;
+	DW1000.getSystemTimestamp(now);
+	_beaconMicros = micros() - (uint32_t)(now - _beaconReceived).wrap().getAsMicroSeconds();
+	_lastBeaconTime = millis();
+
+	if (_superframeSlot == SUPERFRAME_NO_SLOT)
+	{
+		// BLINK in the contention slot, randomly spread to reduce collisions between joining tags
+		_slotOffset = SUPERFRAME_GUARD_TIME * (1 + random(0, 4));
+	}
+	else
+	{
+		_slotOffset = (uint32_t)(_superframeSlot + 1) * _superframeSlotDuration;
+	}
+	_superframeSlotDone = false;
+
+	if (!_superframeSynchronized)
+	{
+		m_log::log_inf(LOG_DW1000, "Superframe joined, slot %d of %d", _superframeSlot, _superframeSlotCount);
+	}
+	_superframeSynchronized = true;
+}
+
+void DW1000RangingClass::superframeTick()
+{
+	if (millis() - _lastBeaconTime > SUPERFRAME_LOST_BEACONS * getSuperframePeriod() / 1000)
+	{
+		// back to the own timer until the next BEACON
+		m_log::log_inf(LOG_DW1000, "Superframe lost");
+		_superframeSynchronized = false;
+		return;
+	}
+	uint32_t slotTime = micros() - _beaconMicros;
+	if (_superframeSlotDone || slotTime + SUPERFRAME_TX_LEAD_TIME < _slotOffset)
+		return;
+
+	_superframeSlotDone = true;
+	uint32_t cycleAirtime = getCycleAirtime();
+	uint32_t latestStart = _slotOffset + (_superframeSlotDuration > cycleAirtime ? _superframeSlotDuration - cycleAirtime : 0);
+	if (slotTime > latestStart)
+	{
+		// the cycle would run into the next slot, wait for the next superframe
+		_missedSlots++;
+		return;
+	}
+	_transmitInSlot = true;
+	if (_superframeSlot == SUPERFRAME_NO_SLOT)
+		transmitBlink();
+	else
+		rangingCycle();
+	_transmitInSlot = false;
+}
+
+boolean DW1000RangingClass::transmitInSlot(byte datas[], uint16_t length)
+{
+	DW1000Time slotTime = _beaconReceived + DW1000Time((int32_t)_slotOffset, DW1000Time::MICROSECONDS);
+	DW1000Time futureTime;
+	if (!DW1000.setDelayAt(slotTime, futureTime))
+	{
+		// loop() came too late, sent now it could collide with the next slot
+		_missedSlots++;
+		DW1000.setReceiveFrameWaitTimeout(0);
+		receiver();
+		return false;
+	}
+	DW1000.setData(datas, length);
+	DW1000.startTransmit();
+	return true;
+}
+
+/* ###########################################################################
+ * #### TDoA #################################################################
+ * ########################################################################### */
+
+void DW1000RangingClass::startTdoaReference()
+{
+	_tdoa = true;
+	_tdoaReferenceAnchor = true;
+	// first SYNC on the next loop()
+	_lastSyncTime = millis() - TDOA_SYNC_INTERVAL;
+}
+
+void DW1000RangingClass::setTdoaReferenceDistance(float distance)
+{
+	_tdoaReferenceTof.setTimestamp((int64_t)(distance * DW1000Time::DISTANCE_OF_RADIO_INV));
+}
+
+boolean DW1000RangingClass::isTdoaSynchronized()
+{
+	if (_tdoaReferenceAnchor)
+		return true;
+	return _tdoaReference.hasClockDrift() && millis() - _lastSyncReceivedTime < TDOA_SYNC_LOST * TDOA_SYNC_INTERVAL;
+}
+
+void DW1000RangingClass::transmitSync()
+{
+	_lastSyncTime = millis();
+
+	transmitInit();
+	byte shortBroadcast[2] = {0xFF, 0xFF};
+	_globalMac.generateShortMACFrame(sentData, _ownShortAddress, shortBroadcast);
+	sentData[SHORT_MAC_LEN] = static_cast<byte>(MessageType::SYNC);
+	sentData[SHORT_MAC_LEN + 1] = _syncSequence++;
+	// delayed, so the frame can carry its own TX timestamp
+	DW1000Time syncSent = DW1000.setDelay(DW1000Time(_replyDelayTime, DW1000Time::MICROSECONDS));
+	syncSent.getTimestamp(sentData + SHORT_MAC_LEN + 2);
+
+	DW1000.setData(sentData, SHORT_MAC_LEN + 2 + DW1000Time::LENGTH_TIMESTAMP);
+	DW1000.startTransmit();
+}
+
+void DW1000RangingClass::handleSync()
+{
+	byte address[2];
+	_globalMac.decodeShortMACFrame(receivedData, address);
+	DW1000Time syncSent;
+	syncSent.setTimestamp(receivedData + SHORT_MAC_LEN + 2);
+
+	if (memcmp(address, _tdoaReference.getByteShortAddress(), 2) != 0)
+	{
+		// new reference anchor, start the fit over
+		_tdoaReference = DW1000Device(address);
+	}
+	else if (millis() - _lastSyncReceivedTime < TDOA_SYNC_LOST * TDOA_SYNC_INTERVAL)
+	{
+		// from the last SYNC to this one on both clocks
+		boolean wasSynchronized = _tdoaReference.hasClockDrift();
+		_tdoaReference.updateClockDrift((_receivedFrame->timestamp - _syncReceived).wrap(), (syncSent - _syncSent).wrap());
+		if (!wasSynchronized && _tdoaReference.hasClockDrift())
+		{
+			m_log::log_inf(LOG_DW1000, "TDoA synchronized, reference %X", _tdoaReference.getShortAddress());
+		}
+	}
+	_syncSent = syncSent;
+	_syncReceived = _receivedFrame->timestamp;
+	_lastSyncReceivedTime = millis();
+}
+
+void DW1000RangingClass::handleTdoaBlink()
+{
+	if (!isTdoaSynchronized())
+		return;
+
+	byte shortAddress[2];
+	_globalMac.decodeBlinkFrame(receivedData, shortAddress);
+	DW1000Time referenceTime = _receivedFrame->timestamp;
+	if (!_tdoaReferenceAnchor)
+	{
+		// reference clock at the last SYNC (TX + flight), plus the time since then at its rate
+		DW1000Time sinceSync = (_receivedFrame->timestamp - _syncReceived).wrap();
+		int64_t drift = (int64_t)((float)sinceSync.getTimestamp() * _tdoaReference.getClockDrift());
+		referenceTime = (_syncSent + _tdoaReferenceTof + sinceSync + DW1000Time(drift)).wrap();
+	}
+	if (_handleTdoaBlink != 0)
+	{
+		(*_handleTdoaBlink)((uint16_t)(shortAddress[1] * 256 + shortAddress[0]), receivedData[1], referenceTime);
+	}
 }
 
 void DW1000RangingClass::receiver()
@@ -1038,15 +1940,178 @@ void DW1000RangingClass::receiver()
 	DW1000.startReceive();
 }
 
+float DW1000RangingClass::getDeviceScore(DW1000Device *device)
+{
+	// in dB: signal strength, less the first path deficit (NLOS), plus reliability
+	float firstPathDeficit = device->getRXPower() - device->getFPPower();
+	return device->getRXPower() - SCORE_FIRST_PATH_WEIGHT * firstPathDeficit + SCORE_SUCCESS_WEIGHT * device->successRate;
+}
+
+void DW1000RangingClass::selectPolledDevices()
+{
+	// fill the selection with the best anchors, then at most one swap per POLL and only
+	// for a clearly better anchor, so the polled set does not flap between close scores
+	uint8_t selectedCount = 0;
+	for (uint8_t i = 0; i < _networkDevicesNumber; i++)
+	{
+		if (_networkDevices[i].selected)
+			selectedCount++;
+	}
+	// fewer anchors per round than before: the lowest scores leave the selection
+	while (selectedCount > _anchorsPerRound)
+	{
+		DW1000Device *worst = nullptr;
+		for (uint8_t i = 0; i < _networkDevicesNumber; i++)
+		{
+			DW1000Device *device = &_networkDevices[i];
+			if (device->selected && (worst == nullptr || getDeviceScore(device) < getDeviceScore(worst)))
+				worst = device;
+		}
+		worst->selected = false;
+		selectedCount--;
+	}
+	while (true)
+	{
+		DW1000Device *best = nullptr;
+		DW1000Device *worst = nullptr;
+		for (uint8_t i = 0; i < _networkDevicesNumber; i++)
+		{
+			DW1000Device *device = &_networkDevices[i];
+			if (device->selected)
+			{
+				if (worst == nullptr || getDeviceScore(device) < getDeviceScore(worst))
+					worst = device;
+			}
+			else if (best == nullptr || getDeviceScore(device) > getDeviceScore(best))
+			{
+				best = device;
+			}
+		}
+		if (best == nullptr)
+			return;
+		if (selectedCount < _anchorsPerRound)
+		{
+			best->selected = true;
+			selectedCount++;
+			continue;
+		}
+		if (getDeviceScore(best) > getDeviceScore(worst) + POLL_SELECTION_HYSTERESIS)
+		{
+			worst->selected = false;
+			best->selected = true;
+		}
+		return;
+	}
+}
+
+int16_t DW1000RangingClass::contentionSlot(DW1000Device *tag, uint8_t slots)
+{
+	// returns the RANGING_INIT slot to use or -1 to stay silent this time
+	if (slots == 0)
+	{
+		return -1;
+	}
+	if (tag->contentionDefer > 0)
+	{
+		// backing off, answer when the count is over
+		if (--tag->contentionDefer > 0)
+			return -1;
+	}
+	else
+	{
+		// the tag answered again without knowing us: our last RANGING_INIT collided
+		if (tag->rangingInitPending && tag->contentionBackoff < CONTENTION_MAX_BACKOFF)
+		{
+			tag->contentionBackoff++;
+		}
+		// pick one slot among the slots of the next 2^backoff opportunities
+		uint32_t pick = contentionRandom((uint32_t)slots << tag->contentionBackoff);
+		tag->contentionDefer = pick / slots;
+		if (tag->contentionDefer > 0)
+		{
+			tag->rangingInitPending = false;
+			return -1;
+		}
+	}
+	tag->rangingInitPending = true;
+	return contentionRandom(slots);
+}
+
+uint32_t DW1000RangingClass::contentionRandom(uint32_t bound)
+{
+	// xorshift32
+	_contentionRandom ^= _contentionRandom << 13;
+	_contentionRandom ^= _contentionRandom >> 17;
+	_contentionRandom ^= _contentionRandom << 5;
+	return _contentionRandom % bound;
+}
+
+uint16_t DW1000RangingClass::blinkFilterBit(const byte address[], uint8_t i)
+{
+	// double hashing g_i = h1 + i * h2 from one multiplicative hash of the short address,
+	// h2 is odd so the BLINK_FILTER_HASHES bits are distinct
+	uint32_t hash = ((uint32_t)address[0] | ((uint32_t)address[1] << 8)) * 0x9E3779B1UL;
+	uint16_t h1 = hash >> 16;
+	uint16_t h2 = (hash >> 3) | 1;
+	return (uint16_t)(h1 + i * h2) % BLINK_FILTER_BITS;
+}
+
+void DW1000RangingClass::addToBlinkFilter(byte filter[], const byte address[])
+{
+	for (uint8_t i = 0; i < BLINK_FILTER_HASHES; i++)
+	{
+		uint16_t bit = blinkFilterBit(address, i);
+		filter[bit / 8] |= (1 << (bit % 8));
+	}
+}
+
+bool DW1000RangingClass::isInBlinkFilter(const byte filter[], const byte address[])
+{
+	for (uint8_t i = 0; i < BLINK_FILTER_HASHES; i++)
+	{
+		uint16_t bit = blinkFilterBit(address, i);
+		if (!(filter[bit / 8] & (1 << (bit % 8))))
+			return false;
+	}
+	return true;
+}
+
 uint16_t DW1000RangingClass::getReplyTimeOfIndex(int i)
 {
-	return (2 * i + 1) * DEFAULT_REPLY_DELAY_TIME;
+	return getReplyTimeOfIndex(i, _replyDelayTime);
+}
+
+uint16_t DW1000RangingClass::getReplyTimeOfIndex(int i, uint16_t slotWidth)
+{
+	return (2 * i + 1) * slotWidth;
 }
 
 /* ###########################################################################
  * #### Methods for range computation and corrections  #######################
  * ########################################################################### */
 
+void DW1000RangingClass::trackClockDrift(DW1000Device *device, const DW1000Time &localSpan, const DW1000Time &remoteSpan)
+{
+	boolean badCrystal = device->hasBadCrystal();
+	device->updateClockDrift(localSpan, remoteSpan);
+	if (device->hasBadCrystal() && !badCrystal)
+	{
+		m_log::log_err(LOG_DW1000, "Device %X clock drift %d ppm, out of spec", device->getShortAddress(), (int)(device->getClockDrift() * 1e6f));
+	}
+}
+
+void DW1000RangingClass::computeRangeSingleSided(DW1000Device *myDistantDevice, DW1000Time *myTOF)
+{
+	// tof = (round - reply * (1 - offset)) / 2, the correction is small enough for float
+	DW1000Time round1 = (myDistantDevice->timePollAckReceived - myDistantDevice->timePollSent).wrap();
+	DW1000Time reply1 = (myDistantDevice->timePollAckSent - myDistantDevice->timePollReceived).wrap();
+	// the tracked drift once it has converged, the carrier integrator until then
+	float offset = myDistantDevice->hasClockDrift() ? myDistantDevice->getClockDrift() : myDistantDevice->clockOffset;
+	int64_t correction = (int64_t)((float)reply1.getTimestamp() * offset);
+
+	myTOF->setTimestamp((round1.getTimestamp() - reply1.getTimestamp() + correction) / 2);
+}
+
 void DW1000RangingClass::computeRangeAsymmetric(DW1000Device *myDistantDevice, DW1000Time *myTOF)
 {
 	// asymmetric two-way ranging (more computation intense, less error prone)
@@ -1072,4 +2137,206 @@ void DW1000RangingClass::computeRangeAsymmetric(DW1000Device *myDistantDevice, D
 	m_log::log_vrb(LOG_DW1000_MSG, "timeRangeSentMinusPollAckReceived %d", myDistantDevice->timeRangeSentMinusPollAckReceived.getTimestamp());
 	m_log::log_vrb(LOG_DW1000_MSG, "reply2 ", (long)reply2.getTimestamp());
 	*/
-}
\ No newline at end of file
+}
+
+/* ###########################################################################
+ * #### Anchor self-survey ###################################################
+ * ########################################################################### */
+
+void DW1000RangingClass::startSurvey(uint16_t cycles)
+{
+	_lastSurveyTime = millis();
+	if (_type != BoardType::ANCHOR || _tdoa || cycles == 0)
+		return;
+
+	m_log::log_inf(LOG_DW1000, "Survey started");
+	// the tags come back with their next BLINK
+	_networkDevicesNumber = 0;
+	_surveyCount = 0;
+	_surveyCyclesLeft = cycles;
+	_type = BoardType::TAG;
+	_expectedMsgId = MessageType::POLL_ACK;
+	counterForBlink = 0;
+	_blinkInterval = BLINK_INTERVAL_MIN;
+}
+
+void DW1000RangingClass::setSurveyPeriod(uint32_t period)
+{
+	_surveyPeriod = period;
+	// the first survey is SURVEY_STAGGER times the address slot from now
+	_lastSurveyTime = millis() - period + (uint32_t)(_ownShortAddress[0] % SURVEY_STAGGER_SLOTS) * SURVEY_STAGGER;
+}
+
+void DW1000RangingClass::addSurveyRange(DW1000Device *device)
+{
+	float range = device->getRange();
+	if (range <= 0)
+		return;
+	uint8_t i = 0;
+	while (i < _surveyCount && _surveyAddresses[i] != device->getShortAddress())
+		i++;
+	if (i == _surveyCount)
+	{
+		if (_surveyCount == SURVEY_MAX_ANCHORS)
+			return;
+		_surveyAddresses[i] = device->getShortAddress();
+		_surveyRangeSum[i] = 0;
+		_surveyRangeCount[i] = 0;
+		_surveyCount++;
+	}
+	_surveyRangeSum[i] += range;
+	_surveyRangeCount[i]++;
+}
+
+void DW1000RangingClass::endSurvey()
+{
+	_surveyCyclesLeft = 0;
+	_networkDevicesNumber = 0;
+	_type = BoardType::ANCHOR;
+	_replyTimeOfLastPollAck = 0;
+	_pollAckWindowClosed = false;
+	_blinkInterval = BLINK_INTERVAL;
+	counterForBlink = 0;
+	DW1000.setReceiveFrameWaitTimeout(0);
+	receiver();
+
+	float ranges[SURVEY_MAX_ANCHORS];
+	for (uint8_t i = 0; i < _surveyCount; i++)
+		ranges[i] = _surveyRangeSum[i] / _surveyRangeCount[i];
+	m_log::log_inf(LOG_DW1000, "Survey done, %d anchors", _surveyCount);
+	if (_handleSurveyDone != 0)
+	{
+		(*_handleSurveyDone)(_surveyAddresses, ranges, _surveyCount);
+	}
+}
+
+void DW1000RangingClass::setAnchorPosition(const float position[3])
+{
+	memcpy(_position, position, sizeof(_position));
+	_hasPosition = true;
+}
+
+/* ###########################################################################
+ * #### Zones ################################################################
+ * ########################################################################### */
+
+void DW1000RangingClass::setZone(uint8_t zone, const uint8_t neighbours[], uint8_t count)
+{
+	_zone = zone;
+	_zoneNeighbourCount = count < ZONE_MAX_NEIGHBOURS ? count : ZONE_MAX_NEIGHBOURS;
+	if (_zoneNeighbourCount > 0)
+		memcpy(_zoneNeighbours, neighbours, _zoneNeighbourCount);
+}
+
+boolean DW1000RangingClass::isTagZoneServed(uint8_t zone)
+{
+	if (zone == ZONE_NONE || _zone == ZONE_NONE || zone == _zone)
+		return true;
+	for (uint8_t i = 0; i < _zoneNeighbourCount; i++)
+	{
+		if (_zoneNeighbours[i] == zone)
+			return true;
+	}
+	return false;
+}
+
+boolean DW1000RangingClass::isAnchorZoneKept(DW1000Device *anchor)
+{
+	uint8_t zone = anchor->getZone();
+	if (zone == ZONE_NONE || _zone == ZONE_NONE || zone == _zone || anchor->isZoneNeighbour(_zone))
+		return true;
+	// a neighbour of our zone according to the anchors of our zone
+	for (uint8_t i = 0; i < _networkDevicesNumber; i++)
+	{
+		if (_networkDevices[i].getZone() == _zone && _networkDevices[i].isZoneNeighbour(zone))
+			return true;
+	}
+	return false;
+}
+
+void DW1000RangingClass::handOver(uint8_t zone)
+{
+	if (zone == _zone)
+		return;
+	m_log::log_inf(LOG_DW1000, "Zone %d -> %d", _zone, zone);
+	_zone = zone;
+
+	// forget the anchors of the zones no longer around, from the last one so removing keeps the indexes
+	for (int16_t i = _networkDevicesNumber - 1; i >= 0; i--)
+	{
+		if (!isAnchorZoneKept(&_networkDevices[i]))
+		{
+			if (_handleInactiveDevice != 0)
+			{
+				(*_handleInactiveDevice)(&_networkDevices[i]);
+			}
+			removeNetworkDevices(i);
+		}
+	}
+	// the anchors of the new neighbours still have to be found
+	shortenBlinkInterval(BLINK_INTERVAL_MIN);
+}
+
+/* ###########################################################################
+ * #### Antenna delay calibration ############################################
+ * ########################################################################### */
+
+void DW1000RangingClass::transmitAntennaDelays(const uint16_t addresses[], const uint16_t antennaDelays[], uint8_t count)
+{
+	uint16_t ownAddress = _ownShortAddress[1] * 256 + _ownShortAddress[0];
+	uint8_t maxCount = (LEN_DATA - SHORT_MAC_LEN - 2) / 4;
+	if (count > maxCount)
+		count = maxCount;
+
+	transmitInit();
+	byte shortBroadcast[2] = {0xFF, 0xFF};
+	_globalMac.generateShortMACFrame(sentData, _ownShortAddress, shortBroadcast);
+	sentData[SHORT_MAC_LEN] = static_cast<byte>(MessageType::ANTENNA_DELAY);
+	sentData[SHORT_MAC_LEN + 1] = count;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		// address and delay, low byte first like the short addresses
+		byte *entry = sentData + SHORT_MAC_LEN + 2 + 4 * i;
+		entry[0] = addresses[i] & 0xFF;
+		entry[1] = addresses[i] >> 8;
+		entry[2] = antennaDelays[i] & 0xFF;
+		entry[3] = antennaDelays[i] >> 8;
+		if (addresses[i] == ownAddress)
+			applyAntennaDelay(antennaDelays[i]);
+	}
+	transmit(sentData, SHORT_MAC_LEN + 2 + 4 * count);
+}
+
+void DW1000RangingClass::handleAntennaDelays()
+{
+	byte address[2];
+	_globalMac.decodeShortMACFrame(receivedData, address);
+	if (_calibratorAddress == CALIBRATOR_NONE || address[1] * 256 + address[0] != _calibratorAddress)
+	{
+		m_log::log_dbg(LOG_DW1000, "ANTENNA_DELAY from %X ignored", address[1] * 256 + address[0]);
+		return;
+	}
+
+	uint8_t count = receivedData[SHORT_MAC_LEN + 1];
+	for (uint8_t i = 0; i < count && SHORT_MAC_LEN + 2 + 4 * i + 4 <= _receivedFrame->length; i++)
+	{
+		byte *entry = receivedData + SHORT_MAC_LEN + 2 + 4 * i;
+		if (entry[0] == _ownShortAddress[0] && entry[1] == _ownShortAddress[1])
+		{
+			applyAntennaDelay(entry[3] * 256 + entry[2]);
+			return;
+		}
+	}
+}
+
+void DW1000RangingClass::applyAntennaDelay(uint16_t antennaDelay)
+{
+	if (DW1000.getAntennaDelay() == antennaDelay)
+		return; // the same list sent again
+	m_log::log_inf(LOG_DW1000, "Antenna delay %d", antennaDelay);
+	DW1000.setAntennaDelay(antennaDelay);
+	if (_handleAntennaDelay != 0)
+	{
+		(*_handleAntennaDelay)(antennaDelay);
+	}
+}
@@ -30,6 +30,7 @@
 #include "DW1000Time.h"
 #include "DW1000Device.h"
 #include "DW1000Mac.h"
+#include "DW1000Survey.h"
 
 //Log tags
 
@@ -42,17 +43,83 @@ enum class MessageType : byte
 	RANGE_REPORT = 3,
 	BLINK = 4,
 	RANGING_INIT = 5,
+	BEACON = 6,
+	RANGE_COMPACT = 7,
+	SYNC = 8,
+	ANTENNA_DELAY = 9,
 	TYPE_ERROR = 254,
 	RANGE_FAILED = 255,
 };
 
+#if DW1000_EXTENDED_FRAMES
+#define LEN_DATA 256
+#else
 #define LEN_DATA 90
+#endif
+
+// POLL_ACK capabilities: a marker byte and the feature flags follow the message type
+#define POLL_ACK_CAPABILITY_MARKER 0xCA
+#define CAPABILITY_RANGE_COMPACT 0x01
+// the POLL_ACK carries the range of the previous exchange (float, after the flags)
+#define CAPABILITY_RANGE_REPORT 0x02
+// the POLL_ACK carries our POLL RX and POLL_ACK TX timestamps, and the RX timestamp of
+// the previous RANGE when that exchange completed
+#define CAPABILITY_TIMESTAMPS 0x04
+#define CAPABILITY_PREVIOUS_RANGE_RX 0x08
+// RANGING_INIT flags (byte after the type): the anchor coordinates follow (3 floats)
+#define RANGING_INIT_POSITION 0x01
+// then the anchor zone, the number of neighbour zones and the neighbour zones
+#define RANGING_INIT_ZONE 0x02
+#define POLL_INDEX_NONE 0xFF
+
+// Max anchors in one POLL/RANGE round (a RANGE takes 12 bytes per anchor)
+#if DW1000_EXTENDED_FRAMES
+#define RANGING_MAX_ANCHORS 20
+#else
+#define RANGING_MAX_ANCHORS 6
+#endif
+// Defaults: anchors polled per round and POLL_ACK slots left for unknown anchors
+#define DEFAULT_ANCHORS_PER_ROUND 4
+#define POLL_FREE_SLOTS 2
+// Margin [ms] past the POLL_ACK window after which loop() ends the round itself, the receive
+// timeout of the chip always comes first unless it failed
+#define POLL_ACK_WATCHDOG_MARGIN 10
+
+// Received frames waiting for loop(), one per DW1000 RX buffer
+#define RECEIVE_QUEUE_SIZE 2
 
 // Max devices we put in the networkDevices array ! Each DW1000Device is 74 Bytes in SRAM memory for now.
+#if DW1000_EXTENDED_FRAMES
+#define MAX_DEVICES 24
+#else
 #define MAX_DEVICES 12
+#endif
+
+// RANGING_INIT contention: slots after a BLINK and max backoff exponent
+// (an anchor spreads its answer over up to 2^x BLINKs/POLLs of the tag)
+#define RANGING_INIT_SLOTS 7
+#define CONTENTION_MAX_BACKOFF 4
+
+// Anchor selection for the POLL (tag), in dB: score margin a candidate needs to
+// replace a polled anchor, weight of the first path deficit and of the success rate
+#define POLL_SELECTION_HYSTERESIS 3
+#define SCORE_FIRST_PATH_WEIGHT 1
+#define SCORE_SUCCESS_WEIGHT 20
 
 // One blink every x polls
 #define BLINK_INTERVAL 5
+// The tag adapts it: down to the burst interval when anchors go missing or the
+// RX power moves, doubling up to the max interval while the anchor set is stable
+#define BLINK_INTERVAL_MIN 2
+#define BLINK_INTERVAL_MAX 40
+// in dB, POLL_ACK RX power step that counts as the tag having moved
+#define BLINK_RX_POWER_STEP 6
+// BLINK carries the known anchors as a fixed-size Bloom filter over the short address.
+// False positive rate (1 - e^(-k*n/m))^k: ~1.5% with 12 known anchors, ~8% with 24.
+// A false positive only delays the RANGING_INIT of that anchor to a POLL free slot.
+#define BLINK_FILTER_BITS 128
+#define BLINK_FILTER_HASHES 3
+#define BLINK_FILTER_LEN (BLINK_FILTER_BITS / 8)
 
 // Default Pin for module:
 #define DEFAULT_RST_PIN 9
@@ -75,7 +142,41 @@ enum class BoardType : byte
 // default timer delay
 #define DEFAULT_RANGE_INTERVAL 1500
 
+// One RANGE_REPORT per anchor after the RANGE: the tag gets fresh ranges for N more reply slots
 #define ENABLE_RANGE_REPORT false
+// Each anchor returns its last range in the next POLL_ACK: the tag gets all the ranges
+// one cycle late without any report slot
+#define ENABLE_POLL_ACK_RANGE_REPORT true
+// Each anchor returns its timestamps in the POLL_ACK and the tag computes the ranges of
+// the previous exchange itself, anchors don't need to report ranges anymore
+#define ENABLE_TAG_SIDE_RANGING false
+// Single-sided TWR: POLL and POLL_ACK only, the tag corrects the anchor reply time with the
+// clock offset from the carrier integrator. Less accurate than DS-TWR (see twr_drift_tests.c)
+#define ENABLE_SS_TWR false
+
+// TDMA superframe: slots for tags after the BEACON/contention slot
+#define SUPERFRAME_MAX_SLOTS 32
+#define SUPERFRAME_NO_SLOT 0xFF
+// in us, idle time at the end of each slot
+#define SUPERFRAME_GUARD_TIME 1000
+// in us, the tag programs its delayed transmission that long before its slot
+#define SUPERFRAME_TX_LEAD_TIME 2000
+// BEACONs a tag may miss before it falls back to its own timer
+#define SUPERFRAME_LOST_BEACONS 3
+
+// TDoA: SYNC period of the reference anchor [ms], and SYNC periods without SYNC after
+// which an anchor stops reporting BLINKs
+#define TDOA_SYNC_INTERVAL 100
+#define TDOA_SYNC_LOST 5
+
+// Anchor self-survey: ranging cycles an anchor spends as a tag, and the delay [ms] per short
+// address (low byte, modulo SURVEY_STAGGER_SLOTS) between the periodic surveys of the anchors
+#define SURVEY_CYCLES 100
+#define SURVEY_STAGGER 30000
+#define SURVEY_STAGGER_SLOTS 16
+
+// Antenna delay calibration: no calibrator, ANTENNA_DELAY messages are ignored
+#define CALIBRATOR_NONE 0xFFFF
 
 class DW1000RangingClass
 {
@@ -92,14 +193,125 @@ public:
 	static void attachNewDevice(void (*handleNewDevice)(DW1000Device *)) { _handleNewDevice = handleNewDevice; };
 	static void attachInactiveDevice(void (*handleInactiveDevice)(DW1000Device *)) { _handleInactiveDevice = handleInactiveDevice; };
 	static void attachRemovedDeviceMaxReached(void (*handleRemovedDeviceMaxReached)(DW1000Device *)) { _handleRemovedDeviceMaxReached = handleRemovedDeviceMaxReached; };
-	
+
+	// Frames lost because loop() did not keep up with both RX buffers
+	static uint32_t getReceivedFramesDropped() { return _receivedFramesDropped; };
+
+	// Reply delay [us] between a received message and our answer. Replies are scheduled from the
+	// RX timestamp of the message, so this can go down to getMinimumReplyDelayTime().
+	static void setReplyDelayTime(uint16_t replyDelayTime);
+	static uint16_t getReplyDelayTime() { return _replyDelayTime; };
+	// Shortest reply delay [us] this board managed so far (measured processing time + preamble)
+	static uint16_t getMinimumReplyDelayTime();
+	// Longest reply delay [us] for which the SS-TWR error left by the least known clock drift
+	// estimate stays below maxError [m], see DW1000Device::getClockDriftUncertainty()
+	static uint32_t getDriftLimitedReplyDelayTime(float maxError);
+
+	// Anchors polled per POLL/RANGE round (POLL_FREE_SLOTS more POLL_ACK slots are left for
+	// unknown anchors). Limited by RANGING_MAX_ANCHORS and by the reply delay, as reply times
+	// are 16 bit microseconds. Only the tag's setting matters, the POLL carries the slots.
+	static void setAnchorsPerRound(uint8_t anchors);
+	static uint8_t getAnchorsPerRound() { return _anchorsPerRound; };
+	static uint8_t getMaxAnchorsPerRound();
+	// Replies that missed their RX anchored slot and were sent relative to the current time instead
+	static uint32_t getLateReplies() { return _lateReplies; };
+	// POLL_ACK windows ended by the loop() watchdog instead of the receive timeout of the chip
+	static uint32_t getPollAckWatchdogCount() { return _pollAckWatchdogCount; };
+
+	// Adaptive discovery (tag): current blink interval in polls, BLINKs sent and BLINKs
+	// saved compared to a fixed BLINK_INTERVAL (negative while bursting)
+	static uint8_t getBlinkInterval() { return _blinkInterval; };
+	static uint32_t getBlinksSent() { return _blinksSent; };
+	static int32_t getBlinksSaved() { return (int32_t)(_rangingCycles / BLINK_INTERVAL) - (int32_t)_blinksSent; };
+	// Airtime [ms] of the saved BLINK exchanges (BLINK and RANGING_INIT slots, as in getCycleAirtime())
+	static int32_t getDiscoveryAirtimeSaved() { return getBlinksSaved() * (RANGING_INIT_SLOTS + 1) * (5 * (int32_t)_replyDelayTime / 2) / 1000; };
+
+	// TDMA superframe. The coordinator anchor sends a BEACON every superframe with the slot of
+	// each tag that BLINKed to it, slot 0 is left for the BEACON and BLINKs of tags without slot.
+	// A tag hearing BEACONs only ranges in its own slot, aligned to the BEACON RX timestamp.
+	static void startSuperframeCoordinator();
+	static uint8_t getSuperframeSlots() { return _superframeSlotCount; };
+	// Slot length [us] from the airtime of one ranging cycle, see getCycleAirtime()
+	static uint32_t getSuperframeSlotDuration() { return _superframeSlotDuration; };
+	static uint32_t getSuperframePeriod() { return (uint32_t)(_superframeSlotCount + 1) * _superframeSlotDuration; };
+	static boolean isSuperframeSynchronized() { return _superframeSynchronized; };
+	static uint8_t getSuperframeSlot() { return _superframeSlot; };
+	// Slots the tag skipped, loop() came too late to fit its cycle in them
+	static uint32_t getMissedSlots() { return _missedSlots; };
+	// Airtime [us] of the longest tag cycle (POLL or BLINK exchange) plus guard time
+	static uint32_t getCycleAirtime();
+
+	// TDoA (uplink). Tags only send BLINKs, anchors timestamp them on the clock of a reference
+	// anchor which broadcasts a SYNC every TDOA_SYNC_INTERVAL with its TX timestamp. The other
+	// anchors fit the reference clock (DW1000Device drift tracker) and hand the BLINK times to
+	// the handler, to be gathered and solved with DW1000Tdoa. Set on every board of the network.
+	static void useTdoa(boolean tdoa) { _tdoa = tdoa; };
+	static boolean isTdoa() { return _tdoa; };
+	static void startTdoaReference();
+	// Distance [m] of this anchor from the reference anchor (time of flight of the SYNC)
+	static void setTdoaReferenceDistance(float distance);
+	static boolean isTdoaSynchronized();
+	// Clock drift of the reference anchor relative to ours
+	static float getTdoaClockDrift() { return _tdoaReference.getClockDrift(); };
+	static void attachTdoaBlink(void (*handleTdoaBlink)(uint16_t, uint8_t, const DW1000Time &)) { _handleTdoaBlink = handleTdoaBlink; };
+
+	// Anchor self-survey. The anchor ranges as a tag (DS-TWR) with the other anchors for a number
+	// of ranging cycles, then goes back to anchor and hands the mean range to every anchor it found
+	// to the handler. Fill a DW1000Survey with the ranges of all the anchors to get the coordinates.
+	static void startSurvey(uint16_t cycles = SURVEY_CYCLES);
+	static boolean isSurveying() { return _surveyCyclesLeft > 0; };
+	// Survey again every period [ms] so a moved anchor is noticed, 0 disables. The anchors start
+	// SURVEY_STAGGER apart by short address, only one of them is a tag at a time.
+	static void setSurveyPeriod(uint32_t period);
+	static void attachSurveyDone(void (*handleSurveyDone)(const uint16_t[], const float[], uint8_t)) { _handleSurveyDone = handleSurveyDone; };
+
+	// Antenna delay calibration. Broadcast the delays found with DW1000Calibration, every module
+	// in the list (this one included) applies its own and calls the handler, e.g. to store it.
+	// There is no acknowledge, send it again until all the modules reported the new delay.
+	static void transmitAntennaDelays(const uint16_t addresses[], const uint16_t antennaDelays[], uint8_t count);
+	// Short address of the module allowed to set our antenna delay, CALIBRATOR_NONE (default)
+	// ignores all the ANTENNA_DELAY messages.
+	static void setCalibrator(uint16_t shortAddress) { _calibratorAddress = shortAddress; };
+	static void attachAntennaDelay(void (*handleAntennaDelay)(uint16_t)) { _handleAntennaDelay = handleAntennaDelay; };
+
+	// Coordinates [m] of this anchor (from the survey or DW1000Config), advertised in its
+	// RANGING_INIT. The tags keep them in DW1000Device and need no anchor_matrix (DW1000Locator).
+	static void setAnchorPosition(const float position[3]);
+	static void clearAnchorPosition() { _hasPosition = false; };
+
+	// Zones, for sites with more anchors than a tag can keep. An anchor belongs to a zone and
+	// advertises it with the neighbour zones in RANGING_INIT, it answers only the BLINKs of tags
+	// in its zone or a neighbour one. A tag keeps only the anchors of its active zone and of
+	// the neighbours: it takes the zone of the first anchor found, then moves with handOver()
+	// (e.g. from DW1000Locator::predictZone()). ZONE_NONE: everybody, as without zones.
+	static void setZone(uint8_t zone, const uint8_t neighbours[] = nullptr, uint8_t count = 0);
+	static uint8_t getZone() { return _zone; };
+	static void handOver(uint8_t zone);
+
 private:
 	// Initialization
     static void initCommunication(uint8_t myRST, uint8_t mySS, uint8_t myIRQ);
 	
 	// variables
+	// frame captured from one DW1000 RX buffer together with its own timestamp and diagnostics
+	struct ReceivedFrame
+	{
+		byte data[LEN_DATA];
+		uint16_t length;
+		DW1000Time timestamp;
+		float rxPower;
+		float fpPower;
+		float quality;
+		float clockOffset;
+	};
+	static ReceivedFrame _receivedFrames[RECEIVE_QUEUE_SIZE];
+	static volatile uint8_t _receivedFramesIn;
+	static volatile uint8_t _receivedFramesOut;
+	static uint32_t _receivedFramesDropped;
+	// frame currently handled by loop()
+	static ReceivedFrame *_receivedFrame;
 	// data buffer
-	static byte receivedData[LEN_DATA];
+	static byte *receivedData;
 	static byte sentData[LEN_DATA];
 
 	// Initialization
@@ -130,13 +342,68 @@ private:
 	static volatile uint8_t _networkDevicesNumber;
 	static byte _ownLongAddress[8];
 	static byte _ownShortAddress[2];
-	static byte _lastSentToShortAddress[2];
 	static DW1000Mac _globalMac;
 	static uint32_t lastTimerTick;
 	static uint32_t _replyTimeOfLastPollAck;
 	static uint32_t _timeOfLastPollSent;
 	static uint16_t _addressOfExpectedLastPollAck;
+	// POLL_ACK collection window, enforced by the receive frame wait timeout of the chip
+	static uint32_t _pollAckWindowLength;
+	static volatile boolean _pollAckWindowClosed;
+	// TDMA superframe, coordinator side
+	static boolean _superframeCoordinator;
+	static byte _superframeSlots[SUPERFRAME_MAX_SLOTS][2];
+	// TDMA superframe, tag side
+	static boolean _superframeSynchronized;
+	static uint8_t _superframeSlot;
+	static DW1000Time _beaconReceived;
+	static uint32_t _beaconMicros;
+	static uint32_t _slotOffset;
+	static boolean _superframeSlotDone;
+	static boolean _transmitInSlot;
+	static uint32_t _missedSlots;
+	// both sides
+	static uint8_t _superframeSlotCount;
+	static uint32_t _superframeSlotDuration;
+	// millis of the last BEACON sent (coordinator) or received (tag)
+	static uint32_t _lastBeaconTime;
 	static int16_t counterForBlink;
+	// RANGING_INIT contention random state, seeded with our short address
+	static uint32_t _contentionRandom;
+	// Adaptive discovery
+	static uint8_t _blinkInterval;
+	static boolean _blinkFoundDevice;
+	static uint32_t _blinksSent;
+	static uint32_t _rangingCycles;
+	// TDoA, reference side: SYNC sequence and millis of the last SYNC sent
+	static boolean _tdoa;
+	static boolean _tdoaReferenceAnchor;
+	static uint8_t _syncSequence;
+	static uint32_t _lastSyncTime;
+	// TDoA, anchor side: last SYNC TX (reference clock) and RX (our clock), reference clock
+	// drift and SYNC time of flight
+	static DW1000Time _syncSent;
+	static DW1000Time _syncReceived;
+	static uint32_t _lastSyncReceivedTime;
+	static DW1000Device _tdoaReference;
+	static DW1000Time _tdoaReferenceTof;
+	// advertised anchor coordinates
+	static boolean _hasPosition;
+	static float _position[3];
+	// zone of the board, neighbour zones of an anchor (a tag gets them from its anchors)
+	static uint8_t _zone;
+	static uint8_t _zoneNeighbourCount;
+	static uint8_t _zoneNeighbours[ZONE_MAX_NEIGHBOURS];
+	// anchor self-survey
+	static uint16_t _surveyCyclesLeft;
+	static uint32_t _surveyPeriod;
+	static uint32_t _lastSurveyTime;
+	static uint8_t _surveyCount;
+	static uint16_t _surveyAddresses[SURVEY_MAX_ANCHORS];
+	static float _surveyRangeSum[SURVEY_MAX_ANCHORS];
+	static uint16_t _surveyRangeCount[SURVEY_MAX_ANCHORS];
+	// antenna delay calibration
+	static uint16_t _calibratorAddress;
 
 	// Handlers
 	static void (*_handleNewRange)(DW1000Device *);
@@ -144,16 +411,20 @@ private:
 	static void (*_handleNewDevice)(DW1000Device *);
 	static void (*_handleInactiveDevice)(DW1000Device *);
 	static void (*_handleRemovedDeviceMaxReached)(DW1000Device *);
+	// tag short address, BLINK sequence number, RX time on the reference clock
+	static void (*_handleTdoaBlink)(uint16_t, uint8_t, const DW1000Time &);
+	// anchor short addresses, mean ranges [m], anchor count
+	static void (*_handleSurveyDone)(const uint16_t[], const float[], uint8_t);
+	// new antenna delay
+	static void (*_handleAntennaDelay)(uint16_t);
 
 	// Board type (tag or anchor)
 	static BoardType _type;
-	// Message flow state
+	// Message flow state of the tag, an anchor keeps it per tag in DW1000Device
 	static volatile MessageType _expectedMsgId;
 	// Message sent/received state
 	static volatile boolean _sentAck;
 	static volatile boolean _receivedAck;
-	// Protocol error state
-	static boolean _protocolFailed;
 	// Reset line to the chip
 	static uint8_t _RST;
 	static uint8_t _SS;
@@ -164,12 +435,22 @@ private:
 	static uint16_t _timerDelay;
 	// Millis between one range and another
 	static uint16_t _rangeInterval;
+	// Reply delay after a received message [us]
+	static uint16_t _replyDelayTime;
+	// Anchors per round and POLL_ACK slots of a POLL
+	static uint8_t _anchorsPerRound;
+	static uint8_t _pollAckTimeSlots;
+	static uint32_t _lateReplies;
+	static uint32_t _pollAckWatchdogCount;
 	// Ranging counter (per second)
 	static uint32_t _rangingCountPeriod;
 
 	// Methods
 	static void handleSent();
 	static void handleReceived();
+	static void handleReceiveTimeout();
+	static void rearmPollAckWindow(DW1000Device *myDistantDevice);
+	static void handleReceivedFrame();
 	static void noteActivity();
 	static void resetInactive();
 
@@ -179,8 +460,10 @@ private:
 
 	// ANCHOR ranging protocol
 	static void transmitInit();
-	static void transmit(byte datas[]);
-	static void transmit(byte datas[], DW1000Time time);
+	static void transmit(byte datas[], uint16_t length);
+	static void transmit(byte datas[], uint16_t length, DW1000Time time);
+	static DW1000Time transmit(byte datas[], uint16_t length, DW1000Time time, const DW1000Time &reference);
+	static DW1000Time setReplyDelay(const DW1000Time &reference, const DW1000Time &delay);
 	static void transmitBlink();
 	static void transmitRangingInit(u_int16_t delay = 0);
 	static void transmitPollAck(DW1000Device *myDistantDevice, u_int16_t delay);
@@ -190,12 +473,57 @@ private:
 
 	// TAG ranging protocol
 	static void transmitPoll();
-	static void transmitRange();
+	static void transmitRange(const DW1000Time *reference = nullptr);
 
 	// Methods for range computation
 	static void timerTick();
+	static void rangingCycle();
+	static void adaptBlinkInterval();
+	static void shortenBlinkInterval(uint8_t blinkInterval);
+
+	// TDMA superframe
+	static void transmitBeacon();
+	static void handleBeacon();
+	static void assignSuperframeSlot(byte shortAddress[]);
+	static void superframeTick();
+	static boolean transmitInSlot(byte datas[], uint16_t length);
+
+	// TDoA
+	static void transmitSync();
+	static void handleSync();
+	static void handleTdoaBlink();
+
+	// anchor self-survey
+	static void addSurveyRange(DW1000Device *device);
+	static void endSurvey();
+
+	// zones
+	static boolean isTagZoneServed(uint8_t zone);
+	static boolean isAnchorZoneKept(DW1000Device *anchor);
+
+	// antenna delay calibration
+	static void handleAntennaDelays();
+	static void applyAntennaDelay(uint16_t antennaDelay);
 	static void computeRangeAsymmetric(DW1000Device *myDistantDevice, DW1000Time *myTOF);
+	static void computeRangeSingleSided(DW1000Device *myDistantDevice, DW1000Time *myTOF);
 	static uint16_t getReplyTimeOfIndex(int i);
+	static uint16_t getReplyTimeOfIndex(int i, uint16_t slotWidth);
+
+	// Anchor selection (tag)
+	static void selectPolledDevices();
+	static float getDeviceScore(DW1000Device *device);
+
+	// Clock drift, one interval measured by both clocks
+	static void trackClockDrift(DW1000Device *device, const DW1000Time &localSpan, const DW1000Time &remoteSpan);
+
+	// RANGING_INIT contention
+	static int16_t contentionSlot(DW1000Device *tag, uint8_t slots);
+	static uint32_t contentionRandom(uint32_t bound);
+
+	// BLINK known anchors filter
+	static void addToBlinkFilter(byte filter[], const byte address[]);
+	static bool isInBlinkFilter(const byte filter[], const byte address[]);
+	static uint16_t blinkFilterBit(const byte address[], uint8_t i);
 };
 
 extern DW1000RangingClass DW1000Ranging;
@@ -0,0 +1,336 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file DW1000Survey.cpp
+ * Anchor self-survey from anchor to anchor ranges.
+ */
+
+#include "DW1000Survey.h"
+
+DW1000Survey::DW1000Survey()
+{
+	setAnchorCount(0);
+}
+
+void DW1000Survey::setAnchorCount(uint8_t count)
+{
+	_count = count < SURVEY_MAX_ANCHORS ? count : SURVEY_MAX_ANCHORS;
+	for (uint8_t i = 0; i < SURVEY_MAX_ANCHORS; i++)
+	{
+		_addresses[i] = 0;
+		_coordinates[i][0] = _coordinates[i][1] = _coordinates[i][2] = 0;
+	}
+	clearDistances();
+}
+
+void DW1000Survey::clearDistances()
+{
+	for (uint8_t i = 0; i < SURVEY_MAX_ANCHORS; i++)
+	{
+		for (uint8_t j = 0; j < SURVEY_MAX_ANCHORS; j++)
+			_distances[i][j] = i == j ? 0 : SURVEY_NO_DISTANCE;
+	}
+}
+
+int16_t DW1000Survey::getAnchorIndex(uint16_t address)
+{
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		if (_addresses[i] == address)
+			return i;
+	}
+	return -1;
+}
+
+void DW1000Survey::setDistance(uint8_t i, uint8_t j, float distance)
+{
+	if (i >= _count || j >= _count || i == j)
+		return;
+	// the ranges of both anchors of a pair differ by the antenna delay errors
+	if (_distances[i][j] != SURVEY_NO_DISTANCE)
+		distance = (_distances[i][j] + distance) / 2;
+	_distances[i][j] = _distances[j][i] = distance;
+}
+
+boolean DW1000Survey::solve(uint8_t dimensions)
+{
+	if (dimensions < 2 || dimensions > 3 || _count < dimensions + 1)
+		return false;
+
+	float full[SURVEY_MAX_ANCHORS][SURVEY_MAX_ANCHORS];
+	fillMissingDistances(full);
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		for (uint8_t j = 0; j < _count; j++)
+		{
+			if (full[i][j] < 0)
+				return false; // not connected
+		}
+	}
+
+	classicalScaling(full, dimensions);
+	refine(dimensions);
+	alignFrame(dimensions);
+	return true;
+}
+
+void DW1000Survey::fillMissingDistances(float full[][SURVEY_MAX_ANCHORS])
+{
+	// Floyd-Warshall, a path through other anchors is an upper bound of the distance
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		for (uint8_t j = 0; j < _count; j++)
+			full[i][j] = _distances[i][j];
+	}
+	for (uint8_t k = 0; k < _count; k++)
+	{
+		for (uint8_t i = 0; i < _count; i++)
+		{
+			for (uint8_t j = 0; j < _count; j++)
+			{
+				if (full[i][k] < 0 || full[k][j] < 0)
+					continue;
+				float path = full[i][k] + full[k][j];
+				if (full[i][j] < 0 || path < full[i][j])
+					full[i][j] = path;
+			}
+		}
+	}
+}
+
+void DW1000Survey::classicalScaling(float full[][SURVEY_MAX_ANCHORS], uint8_t dimensions)
+{
+	// B = -1/2 J D^2 J, double centered squared distances
+	float B[SURVEY_MAX_ANCHORS][SURVEY_MAX_ANCHORS];
+	float rowMean[SURVEY_MAX_ANCHORS];
+	float mean = 0;
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		rowMean[i] = 0;
+		for (uint8_t j = 0; j < _count; j++)
+			rowMean[i] += full[i][j] * full[i][j];
+		rowMean[i] /= _count;
+		mean += rowMean[i];
+	}
+	mean /= _count;
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		for (uint8_t j = 0; j < _count; j++)
+			B[i][j] = -0.5f * (full[i][j] * full[i][j] - rowMean[i] - rowMean[j] + mean);
+	}
+
+	// largest eigenpairs by power iteration with deflation
+	for (uint8_t k = 0; k < 3; k++)
+	{
+		for (uint8_t i = 0; i < _count; i++)
+			_coordinates[i][k] = 0;
+		if (k >= dimensions)
+			continue;
+
+		float v[SURVEY_MAX_ANCHORS];
+		for (uint8_t i = 0; i < _count; i++)
+			v[i] = 1.0f + i * (k + 1); // anything not orthogonal to the eigenvector
+		float lambda = 0;
+		for (uint8_t iteration = 0; iteration < 100; iteration++)
+		{
+			float w[SURVEY_MAX_ANCHORS];
+			float norm = 0;
+			for (uint8_t i = 0; i < _count; i++)
+			{
+				w[i] = 0;
+				for (uint8_t j = 0; j < _count; j++)
+					w[i] += B[i][j] * v[j];
+				norm += w[i] * w[i];
+			}
+			norm = sqrtf(norm);
+			if (norm < 1e-9f)
+				break;
+			lambda = 0;
+			for (uint8_t i = 0; i < _count; i++)
+			{
+				lambda += v[i] * w[i];
+				v[i] = w[i] / norm;
+			}
+		}
+		if (lambda <= 0)
+			continue;
+		float scale = sqrtf(lambda);
+		for (uint8_t i = 0; i < _count; i++)
+		{
+			_coordinates[i][k] = v[i] * scale;
+			for (uint8_t j = 0; j < _count; j++)
+				B[i][j] -= lambda * v[i] * v[j];
+		}
+	}
+}
+
+void DW1000Survey::refine(uint8_t dimensions)
+{
+	// Guttman transform one anchor at a time, on the measured pairs only:
+	// x_i = mean over j of x_j + d_ij (x_i - x_j) / |x_i - x_j|, the stress never grows
+	for (uint8_t iteration = 0; iteration < SURVEY_REFINE_ITERATIONS; iteration++)
+	{
+		for (uint8_t i = 0; i < _count; i++)
+		{
+			float sum[3] = {0, 0, 0};
+			uint8_t pairs = 0;
+			for (uint8_t j = 0; j < _count; j++)
+			{
+				if (j == i || _distances[i][j] == SURVEY_NO_DISTANCE)
+					continue;
+				float diff[3] = {0, 0, 0};
+				float length = 0;
+				for (uint8_t k = 0; k < dimensions; k++)
+				{
+					diff[k] = _coordinates[i][k] - _coordinates[j][k];
+					length += diff[k] * diff[k];
+				}
+				length = sqrtf(length);
+				if (length < 1e-6f)
+					continue;
+				for (uint8_t k = 0; k < dimensions; k++)
+					sum[k] += _coordinates[j][k] + _distances[i][j] * diff[k] / length;
+				pairs++;
+			}
+			if (pairs == 0)
+				continue;
+			for (uint8_t k = 0; k < dimensions; k++)
+				_coordinates[i][k] = sum[k] / pairs;
+		}
+	}
+}
+
+void DW1000Survey::alignFrame(uint8_t dimensions)
+{
+	// translate anchor 0 to the origin
+	float origin[3] = {_coordinates[0][0], _coordinates[0][1], _coordinates[0][2]};
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		for (uint8_t k = 0; k < 3; k++)
+			_coordinates[i][k] -= origin[k];
+	}
+
+	// orthonormal axes: x to anchor 1, y towards anchor 2, z = x cross y
+	float axes[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+	float length = 0;
+	for (uint8_t k = 0; k < dimensions; k++)
+		length += _coordinates[1][k] * _coordinates[1][k];
+	length = sqrtf(length);
+	if (length < 1e-6f)
+		return;
+	for (uint8_t k = 0; k < dimensions; k++)
+		axes[0][k] = _coordinates[1][k] / length;
+
+	float dot = 0;
+	for (uint8_t k = 0; k < dimensions; k++)
+		dot += _coordinates[2][k] * axes[0][k];
+	length = 0;
+	for (uint8_t k = 0; k < dimensions; k++)
+	{
+		axes[1][k] = _coordinates[2][k] - dot * axes[0][k];
+		length += axes[1][k] * axes[1][k];
+	}
+	length = sqrtf(length);
+	if (length < 1e-6f)
+		return; // anchors 0, 1 and 2 are collinear
+	for (uint8_t k = 0; k < dimensions; k++)
+		axes[1][k] /= length;
+
+	axes[2][0] = axes[0][1] * axes[1][2] - axes[0][2] * axes[1][1];
+	axes[2][1] = axes[0][2] * axes[1][0] - axes[0][0] * axes[1][2];
+	axes[2][2] = axes[0][0] * axes[1][1] - axes[0][1] * axes[1][0];
+
+	float rotated[SURVEY_MAX_ANCHORS][3];
+	float zSum = 0;
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		for (uint8_t a = 0; a < 3; a++)
+		{
+			rotated[i][a] = 0;
+			if (a >= dimensions)
+				continue;
+			for (uint8_t k = 0; k < 3; k++)
+				rotated[i][a] += _coordinates[i][k] * axes[a][k];
+		}
+		zSum += rotated[i][2];
+	}
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		for (uint8_t a = 0; a < 3; a++)
+			_coordinates[i][a] = a == 2 && zSum < 0 ? -rotated[i][a] : rotated[i][a];
+	}
+}
+
+void DW1000Survey::getCoordinates(uint8_t i, float coordinates[3])
+{
+	for (uint8_t k = 0; k < 3; k++)
+		coordinates[k] = _coordinates[i][k];
+}
+
+float DW1000Survey::getAnchorResidual(uint8_t i)
+{
+	float sum = 0;
+	uint8_t pairs = 0;
+	for (uint8_t j = 0; j < _count; j++)
+	{
+		if (j == i || _distances[i][j] == SURVEY_NO_DISTANCE)
+			continue;
+		float length = 0;
+		for (uint8_t k = 0; k < 3; k++)
+			length += (_coordinates[i][k] - _coordinates[j][k]) * (_coordinates[i][k] - _coordinates[j][k]);
+		float error = sqrtf(length) - _distances[i][j];
+		sum += error * error;
+		pairs++;
+	}
+	return pairs > 0 ? sqrtf(sum / pairs) : 0;
+}
+
+float DW1000Survey::getResidual()
+{
+	float sum = 0;
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		float residual = getAnchorResidual(i);
+		sum += residual * residual;
+	}
+	return _count > 0 ? sqrtf(sum / _count) : 0;
+}
+
+int16_t DW1000Survey::findMovedAnchor(float tolerance)
+{
+	int16_t worst = -1;
+	float worstResidual = tolerance;
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		float residual = getAnchorResidual(i);
+		if (residual > worstResidual)
+		{
+			worst = i;
+			worstResidual = residual;
+		}
+	}
+	return worst;
+}
+
+size_t DW1000Survey::formatAnchorMatrix(char *buffer, size_t size)
+{
+	size_t length = snprintf(buffer, size, "float anchor_matrix[%d][3] = {\n", _count);
+	for (uint8_t i = 0; i < _count && length < size; i++)
+	{
+		length += snprintf(buffer + length, size - length, "  {%.2f, %.2f, %.2f}, // %04X\n",
+						   _coordinates[i][0], _coordinates[i][1], _coordinates[i][2], _addresses[i]);
+	}
+	if (length < size)
+		length += snprintf(buffer + length, size - length, "};\n");
+	return length < size ? length : size - 1;
+}
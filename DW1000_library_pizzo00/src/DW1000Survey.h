@@ -0,0 +1,76 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file DW1000Survey.h
+ * Anchor self-survey: relative anchor coordinates from the anchor to anchor
+ * ranges of DW1000Ranging::startSurvey().
+ */
+
+#ifndef _DW1000Survey_H_INCLUDED
+#define _DW1000Survey_H_INCLUDED
+
+#include "DW1000Time.h"
+
+#define SURVEY_MAX_ANCHORS 12
+// majorization sweeps after the MDS initial guess
+#define SURVEY_REFINE_ITERATIONS 50
+#define SURVEY_NO_DISTANCE -1.0f
+
+class DW1000Survey
+{
+public:
+	DW1000Survey();
+
+	// Anchors by index, the short address is only kept for the output
+	void setAnchorCount(uint8_t count);
+	uint8_t getAnchorCount() { return _count; }
+	void setAnchorAddress(uint8_t i, uint16_t address) { _addresses[i] = address; }
+	uint16_t getAnchorAddress(uint8_t i) { return _addresses[i]; }
+	int16_t getAnchorIndex(uint16_t address);
+	// Measured distance [m] between two anchors, both directions are averaged
+	void setDistance(uint8_t i, uint8_t j, float distance);
+	float getDistance(uint8_t i, uint8_t j) { return _distances[i][j]; }
+	// Forget the distances but keep the coordinates, for a new survey of the same anchors
+	void clearDistances();
+
+	// Classical MDS (missing pairs filled with shortest paths) followed by stress majorization
+	// on the measured pairs. The frame is the one of the sketches: anchor 0 at the origin,
+	// anchor 1 on +x, anchor 2 in the xy plane on the +y side. In 3D the mirror image along z
+	// cannot be told apart, z is chosen so the anchors are mostly above anchor 0.
+	boolean solve(uint8_t dimensions = 3);
+	void getCoordinates(uint8_t i, float coordinates[3]);
+	const float (*getCoordinates())[3] { return _coordinates; }
+
+	// rms difference [m] of measured and solved distances, overall and for one anchor
+	float getResidual();
+	float getAnchorResidual(uint8_t i);
+	// Anchor with the largest residual above tolerance [m] (it probably moved), -1 if none.
+	// After clearDistances() and the ranges of a new survey, before solve() again.
+	int16_t findMovedAnchor(float tolerance);
+
+	// anchor_matrix initializer for the tag sketches, returns the length written
+	size_t formatAnchorMatrix(char *buffer, size_t size);
+
+private:
+	void fillMissingDistances(float full[][SURVEY_MAX_ANCHORS]);
+	void classicalScaling(float full[][SURVEY_MAX_ANCHORS], uint8_t dimensions);
+	void refine(uint8_t dimensions);
+	void alignFrame(uint8_t dimensions);
+
+	uint8_t _count;
+	uint16_t _addresses[SURVEY_MAX_ANCHORS];
+	float _distances[SURVEY_MAX_ANCHORS][SURVEY_MAX_ANCHORS];
+	float _coordinates[SURVEY_MAX_ANCHORS][3];
+};
+
+#endif
@@ -0,0 +1,324 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file DW1000Tdoa.cpp
+ * Position solver for the TDoA mode of DW1000Ranging.
+ */
+
+#include "DW1000Tdoa.h"
+
+// in place Gauss-Jordan inverse of a n x n matrix (n <= 3), false if singular
+static boolean invert(float m[3][3], uint8_t n)
+{
+	float inverse[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+	for (uint8_t col = 0; col < n; col++)
+	{
+		uint8_t pivot = col;
+		for (uint8_t row = col + 1; row < n; row++)
+		{
+			if (fabsf(m[row][col]) > fabsf(m[pivot][col]))
+				pivot = row;
+		}
+		if (fabsf(m[pivot][col]) < 1e-9f)
+			return false;
+		for (uint8_t k = 0; k < n; k++)
+		{
+			float tmp = m[col][k];
+			m[col][k] = m[pivot][k];
+			m[pivot][k] = tmp;
+			tmp = inverse[col][k];
+			inverse[col][k] = inverse[pivot][k];
+			inverse[pivot][k] = tmp;
+		}
+		float scale = 1 / m[col][col];
+		for (uint8_t k = 0; k < n; k++)
+		{
+			m[col][k] *= scale;
+			inverse[col][k] *= scale;
+		}
+		for (uint8_t row = 0; row < n; row++)
+		{
+			if (row == col)
+				continue;
+			float factor = m[row][col];
+			for (uint8_t k = 0; k < n; k++)
+			{
+				m[row][k] -= factor * m[col][k];
+				inverse[row][k] -= factor * inverse[col][k];
+			}
+		}
+	}
+	memcpy(m, inverse, sizeof(inverse));
+	return true;
+}
+
+DW1000Tdoa::DW1000Tdoa()
+{
+	_count = 0;
+	_dimensions = 3;
+	_residual = 0;
+}
+
+boolean DW1000Tdoa::copyAnchors(const float anchors[][3], uint8_t count, uint8_t dimensions)
+{
+	_count = 0;
+	if (count > TDOA_MAX_ANCHORS || dimensions < 2 || dimensions > 3 || count < dimensions + 1)
+		return false;
+	_dimensions = dimensions;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		_norm2[i] = 0;
+		for (uint8_t k = 0; k < 3; k++)
+		{
+			_anchors[i][k] = k < dimensions ? anchors[i][k] : 0;
+			_norm2[i] += _anchors[i][k] * _anchors[i][k];
+		}
+	}
+	return true;
+}
+
+boolean DW1000Tdoa::setAnchors(const float anchors[][3], uint8_t count, uint8_t dimensions, const float pseudoInverse[][TDOA_MAX_ANCHORS - 1])
+{
+	if (!copyAnchors(anchors, count, dimensions))
+		return false;
+	memcpy(_pseudoInverse, pseudoInverse, sizeof(_pseudoInverse));
+	_count = count;
+	return true;
+}
+
+void DW1000Tdoa::getPseudoInverse(float pseudoInverse[][TDOA_MAX_ANCHORS - 1])
+{
+	memcpy(pseudoInverse, _pseudoInverse, sizeof(_pseudoInverse));
+}
+
+boolean DW1000Tdoa::setAnchors(const float anchors[][3], uint8_t count, uint8_t dimensions)
+{
+	if (!copyAnchors(anchors, count, dimensions))
+		return false;
+
+	float A[TDOA_MAX_ANCHORS - 1][3];
+	for (uint8_t i = 1; i < count; i++)
+	{
+		for (uint8_t k = 0; k < dimensions; k++)
+			A[i - 1][k] = 2 * (_anchors[i][k] - _anchors[0][k]);
+	}
+
+	// (A^T A)^-1 A^T, it only depends on the anchor layout
+	float ATA[3][3];
+	for (uint8_t j = 0; j < dimensions; j++)
+	{
+		for (uint8_t k = 0; k < dimensions; k++)
+		{
+			ATA[j][k] = 0;
+			for (uint8_t i = 0; i < count - 1; i++)
+				ATA[j][k] += A[i][j] * A[i][k];
+		}
+	}
+	if (!invert(ATA, dimensions))
+		return false;
+	for (uint8_t j = 0; j < dimensions; j++)
+	{
+		for (uint8_t i = 0; i < count - 1; i++)
+		{
+			_pseudoInverse[j][i] = 0;
+			for (uint8_t k = 0; k < dimensions; k++)
+				_pseudoInverse[j][i] += ATA[j][k] * A[i][k];
+		}
+	}
+	_count = count;
+	return true;
+}
+
+boolean DW1000Tdoa::solve(const DW1000Time arrivals[], float position[3], uint8_t refine)
+{
+	float rangeDifferences[TDOA_MAX_ANCHORS - 1];
+	for (uint8_t i = 1; i < _count; i++)
+	{
+		// signed difference of two 40 bit timestamps
+		int64_t ticks = (arrivals[i] - arrivals[0]).wrap().getTimestamp();
+		if (ticks > DW1000Time::TIME_OVERFLOW / 2)
+			ticks -= DW1000Time::TIME_OVERFLOW;
+		rangeDifferences[i - 1] = ticks * DW1000Time::DISTANCE_OF_RADIO;
+	}
+	return solve(rangeDifferences, position, refine);
+}
+
+boolean DW1000Tdoa::solve(const float rangeDifferences[], float position[3], uint8_t refine)
+{
+	if (_count == 0)
+		return false;
+
+	// 2 (s_i - s_0) x = |s_i|^2 - |s_0|^2 - r_i^2 - 2 r_i d_0, so x = a + b d_0
+	float a[3] = {0, 0, 0};
+	float b[3] = {0, 0, 0};
+	for (uint8_t i = 1; i < _count; i++)
+	{
+		float r = rangeDifferences[i - 1];
+		float c = _norm2[i] - _norm2[0] - r * r;
+		for (uint8_t k = 0; k < _dimensions; k++)
+		{
+			a[k] += _pseudoInverse[k][i - 1] * c;
+			b[k] -= _pseudoInverse[k][i - 1] * 2 * r;
+		}
+	}
+
+	// |a + b d_0 - s_0|^2 = d_0^2
+	float u[3];
+	float qa = -1, qb = 0, qc = 0;
+	for (uint8_t k = 0; k < _dimensions; k++)
+	{
+		u[k] = a[k] - _anchors[0][k];
+		qa += b[k] * b[k];
+		qb += 2 * u[k] * b[k];
+		qc += u[k] * u[k];
+	}
+	float roots[2];
+	uint8_t rootCount = 0;
+	if (fabsf(qa) < 1e-6f)
+	{
+		if (qb != 0)
+			roots[rootCount++] = -qc / qb;
+	}
+	else
+	{
+		float discriminant = qb * qb - 4 * qa * qc;
+		if (discriminant >= 0)
+		{
+			float sq = sqrtf(discriminant);
+			roots[rootCount++] = (-qb + sq) / (2 * qa);
+			roots[rootCount++] = (-qb - sq) / (2 * qa);
+		}
+		else
+		{
+			// noise pushed the solution off the constraint, take the closest point
+			roots[rootCount++] = -qb / (2 * qa);
+		}
+	}
+
+	// the root with the smallest residual, d_0 is a distance
+	float best = -1;
+	float bestResidual = 0;
+	for (uint8_t j = 0; j < rootCount; j++)
+	{
+		float d0 = roots[j] > 0 ? roots[j] : 0;
+		float candidate[3] = {0, 0, 0};
+		for (uint8_t k = 0; k < _dimensions; k++)
+			candidate[k] = a[k] + b[k] * d0;
+		float candidateResidual = residual(rangeDifferences, candidate);
+		if (best < 0 || candidateResidual < bestResidual)
+		{
+			best = d0;
+			bestResidual = candidateResidual;
+		}
+	}
+	if (best < 0)
+		return false;
+
+	position[0] = position[1] = position[2] = 0;
+	for (uint8_t k = 0; k < _dimensions; k++)
+		position[k] = a[k] + b[k] * best;
+
+	for (uint8_t i = 0; i < refine; i++)
+		refineStep(rangeDifferences, position);
+
+	_residual = residual(rangeDifferences, position);
+	return true;
+}
+
+boolean DW1000Tdoa::solveRanges(const float ranges[], float position[3])
+{
+	if (_count == 0)
+		return false;
+
+	position[0] = position[1] = position[2] = 0;
+	for (uint8_t i = 1; i < _count; i++)
+	{
+		float b = ranges[0] * ranges[0] - ranges[i] * ranges[i] + _norm2[i] - _norm2[0];
+		for (uint8_t k = 0; k < _dimensions; k++)
+			position[k] += _pseudoInverse[k][i - 1] * b;
+	}
+
+	float sum = 0;
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		float d2 = 0;
+		for (uint8_t k = 0; k < _dimensions; k++)
+			d2 += (position[k] - _anchors[i][k]) * (position[k] - _anchors[i][k]);
+		float f = sqrtf(d2) - ranges[i];
+		sum += f * f;
+	}
+	_residual = sqrtf(sum / _count);
+	return true;
+}
+
+float DW1000Tdoa::residual(const float rangeDifferences[], const float position[])
+{
+	float distances[TDOA_MAX_ANCHORS];
+	for (uint8_t i = 0; i < _count; i++)
+	{
+		float d2 = 0;
+		for (uint8_t k = 0; k < _dimensions; k++)
+			d2 += (position[k] - _anchors[i][k]) * (position[k] - _anchors[i][k]);
+		distances[i] = sqrtf(d2);
+	}
+	float sum = 0;
+	for (uint8_t i = 1; i < _count; i++)
+	{
+		float f = distances[i] - distances[0] - rangeDifferences[i - 1];
+		sum += f * f;
+	}
+	return sqrtf(sum / (_count - 1));
+}
+
+void DW1000Tdoa::refineStep(const float rangeDifferences[], float position[])
+{
+	// Gauss-Newton: (J^T J) dx = -J^T f with f_i = |x - s_i| - |x - s_0| - r_i
+	float unit0[3];
+	float d0 = 0;
+	for (uint8_t k = 0; k < _dimensions; k++)
+		d0 += (position[k] - _anchors[0][k]) * (position[k] - _anchors[0][k]);
+	d0 = sqrtf(d0);
+	if (d0 < 1e-6f)
+		return;
+	for (uint8_t k = 0; k < _dimensions; k++)
+		unit0[k] = (position[k] - _anchors[0][k]) / d0;
+
+	float JTJ[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+	float JTf[3] = {0, 0, 0};
+	for (uint8_t i = 1; i < _count; i++)
+	{
+		float di = 0;
+		for (uint8_t k = 0; k < _dimensions; k++)
+			di += (position[k] - _anchors[i][k]) * (position[k] - _anchors[i][k]);
+		di = sqrtf(di);
+		if (di < 1e-6f)
+			return;
+		float J[3];
+		for (uint8_t k = 0; k < _dimensions; k++)
+			J[k] = (position[k] - _anchors[i][k]) / di - unit0[k];
+		float f = di - d0 - rangeDifferences[i - 1];
+		for (uint8_t j = 0; j < _dimensions; j++)
+		{
+			JTf[j] += J[j] * f;
+			for (uint8_t k = 0; k < _dimensions; k++)
+				JTJ[j][k] += J[j] * J[k];
+		}
+	}
+	if (!invert(JTJ, _dimensions))
+		return;
+	for (uint8_t j = 0; j < _dimensions; j++)
+	{
+		for (uint8_t k = 0; k < _dimensions; k++)
+			position[j] -= JTJ[j][k] * JTf[k];
+	}
+}
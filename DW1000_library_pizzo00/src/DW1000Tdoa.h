@@ -0,0 +1,71 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * @file DW1000Tdoa.h
+ * Position solver for the TDoA mode of DW1000Ranging: the arrival times of
+ * one BLINK at N anchors, on the clock of the reference anchor, give N-1
+ * range differences to anchor 0.
+ */
+
+#ifndef _DW1000Tdoa_H_INCLUDED
+#define _DW1000Tdoa_H_INCLUDED
+
+#include "DW1000Time.h"
+
+#define TDOA_MAX_ANCHORS 8
+// Gauss-Newton steps after the closed form solution
+#define TDOA_REFINE_ITERATIONS 3
+
+class DW1000Tdoa
+{
+public:
+	DW1000Tdoa();
+
+	// Anchor coordinates [m], x y z per anchor, anchor 0 is the TDoA reference. In 2D the tag
+	// is assumed in the plane of the anchors and z is ignored. Precomputes everything that only
+	// depends on the layout, false if the layout is degenerate (e.g. collinear anchors)
+	boolean setAnchors(const float anchors[][3], uint8_t count, uint8_t dimensions = 3);
+	// Same with the pseudo-inverse of an earlier setAnchors() (getPseudoInverse()), no inversion
+	boolean setAnchors(const float anchors[][3], uint8_t count, uint8_t dimensions, const float pseudoInverse[][TDOA_MAX_ANCHORS - 1]);
+	void getPseudoInverse(float pseudoInverse[][TDOA_MAX_ANCHORS - 1]);
+	uint8_t getAnchorCount() { return _count; }
+
+	// Range differences d_i - d_0 [m] for anchors 1..count-1. Chan's closed form (the position
+	// as a linear function of d_0, then the quadratic constraint on d_0) followed by refine
+	// Gauss-Newton steps on the range differences. False if there is no solution
+	boolean solve(const float rangeDifferences[], float position[3], uint8_t refine = TDOA_REFINE_ITERATIONS);
+	// Same from the arrival times on the reference clock, one per anchor
+	boolean solve(const DW1000Time arrivals[], float position[3], uint8_t refine = TDOA_REFINE_ITERATIONS);
+
+	// Two-way ranging (ToA) with the same matrix: 2 (s_i - s_0) x = d_0^2 - d_i^2 + |s_i|^2 - |s_0|^2,
+	// the least squares of the ToA sketches. Distances [m] for anchors 0..count-1
+	boolean solveRanges(const float ranges[], float position[3]);
+
+	// rms of the range difference (range for solveRanges()) residuals [m] of the last solution
+	float getResidual() { return _residual; }
+
+private:
+	boolean copyAnchors(const float anchors[][3], uint8_t count, uint8_t dimensions);
+	float residual(const float rangeDifferences[], const float position[]);
+	void refineStep(const float rangeDifferences[], float position[]);
+
+	uint8_t _count;
+	uint8_t _dimensions;
+	float _anchors[TDOA_MAX_ANCHORS][3];
+	// |s_i|^2 and the pseudo-inverse (A^T A)^-1 A^T of A_i = 2 (s_i - s_0)
+	float _norm2[TDOA_MAX_ANCHORS];
+	float _pseudoInverse[3][TDOA_MAX_ANCHORS - 1];
+	float _residual;
+};
+
+#endif
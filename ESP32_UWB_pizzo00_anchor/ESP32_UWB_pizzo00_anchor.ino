@@ -7,6 +7,7 @@
 #include <SPI.h>
 #include "DW1000Ranging.h"
 #include "DW1000.h"
+#include "DW1000Config.h"
 
 uint16_t shortAddress = 132; //84:00
 const char *macAddress = "5B:D5:A9:9A:E2:9C";
@@ -20,6 +21,9 @@ uint16_t Adelay = 16580;
 // #3 16607
 // #4 16580
 
+// ESP32_UWB_pizzo00_calibrate, the only module allowed to change the antenna delay
+uint16_t calibratorAddress = 128; //80:00
+
 // calibration distance
 float dist_m = (285 - 1.75) * 0.0254; //meters
 
@@ -38,11 +42,26 @@ const uint8_t PIN_SS = 4;   // spi select pin
 // (actual response times are based on experience made with these parameters)
 static constexpr byte MY_MODE[] = {DW1000.TRX_RATE_6800KBPS, DW1000.TX_PULSE_FREQ_16MHZ, DW1000.TX_PREAMBLE_LEN_64};
 
+// settings kept in flash, the values above are only the first boot defaults
+DW1000Config config;
+
 void setup()
 {
   Serial.begin(115200);
   delay(1000); //wait for serial monitor to connect
   Serial.println("Anchor config and start");
+  if (config.load()) {
+    Serial.println("Stored configuration");
+    shortAddress = config.getShortAddress();
+    Adelay = config.getAntennaDelay();
+  }
+  else {
+    config.setBoardType((uint8_t)BoardType::ANCHOR);
+    config.setShortAddress(shortAddress);
+    config.setAntennaDelay(Adelay);
+    config.setMode(MY_MODE);
+    config.save();
+  }
   Serial.print("Antenna delay ");
   Serial.println(Adelay);
   Serial.print("Calibration distance ");
@@ -50,19 +69,75 @@ void setup()
 
   //init the configuration
   SPI.begin(SPI_SCK, SPI_MISO, SPI_MOSI);
-  DW1000Ranging.init(BoardType::ANCHOR, shortAddress, macAddress, false, MY_MODE, PIN_RST, PIN_SS, PIN_IRQ);
+  DW1000Ranging.init(BoardType::ANCHOR, shortAddress, macAddress, false, config.getMode(), PIN_RST, PIN_SS, PIN_IRQ);
 
   // set antenna delay for anchors only. Tag is default (16384)
   DW1000.setAntennaDelay(Adelay);
 
+  // surveyed coordinates, advertised to the tags
+  for (int i = 0; i < config.getAnchorCount(); i++) {
+    if (config.getAnchorAddress(i) == shortAddress) DW1000Ranging.setAnchorPosition(config.getAnchors()[i]);
+  }
+  // large sites: zone of this anchor and the zones next to it, tags only range with the anchors
+  // of their zone and its neighbours
+  // static const uint8_t neighbours[] = {2};
+  // DW1000Ranging.setZone(1, neighbours, 1);
+
   DW1000Ranging.attachNewRange(newRange);
   DW1000Ranging.attachNewDevice(newDevice);
   DW1000Ranging.attachInactiveDevice(inactiveDevice);
+  DW1000Ranging.attachSurveyDone(surveyDone);
+  // new delay from ESP32_UWB_pizzo00_calibrate
+  DW1000Ranging.setCalibrator(calibratorAddress);
+  DW1000Ranging.attachAntennaDelay(newAntennaDelay);
+  // re-survey once an hour, uncomment to notice moved anchors
+  // DW1000Ranging.setSurveyPeriod(3600000);
 }
 
 void loop()
 {
   DW1000Ranging.loop();
+
+  // 's' on the serial monitor ranges with the other anchors,
+  // 'p x, y, z' stores the coordinates of this anchor (e.g. from DW1000Survey)
+  if (Serial.available()) {
+    char c = Serial.read();
+    if (c == 's') DW1000Ranging.startSurvey();
+    else if (c == 'p') setPosition();
+  }
+}
+
+void setPosition()
+{
+  float position[1][3];
+  for (int k = 0; k < 3; k++) position[0][k] = Serial.parseFloat();
+  config.setAnchors(&shortAddress, position, 1);
+  config.save();
+  DW1000Ranging.setAnchorPosition(position[0]);
+  Serial.print("Position ");
+  Serial.print(position[0][0]);
+  Serial.print(", ");
+  Serial.print(position[0][1]);
+  Serial.print(", ");
+  Serial.println(position[0][2]);
+}
+
+// one line per anchor pair, to be gathered from all anchors in a DW1000Survey, after a D line
+// with the antenna delay the ranges were measured with (for ESP32_UWB_pizzo00_calibrate)
+void surveyDone(const uint16_t addresses[], const float ranges[], uint8_t count)
+{
+  Serial.print("D ");
+  Serial.print(shortAddress, HEX);
+  Serial.print(", ");
+  Serial.println(DW1000.getAntennaDelay());
+  for (int i = 0; i < count; i++) {
+    Serial.print("S ");
+    Serial.print(shortAddress, HEX);
+    Serial.print(", ");
+    Serial.print(addresses[i], HEX);
+    Serial.print(", ");
+    Serial.println(ranges[i]);
+  }
 }
 
 void newRange(DW1000Device *device)
@@ -80,6 +155,15 @@ void newRange(DW1000Device *device)
   Serial.println(dist);
 }
 
+void newAntennaDelay(uint16_t delay)
+{
+  Adelay = delay;
+  config.setAntennaDelay(Adelay);
+  config.save();
+  Serial.print("Antenna delay ");
+  Serial.println(Adelay);
+}
+
 void newDevice(DW1000Device *device)
 {
   Serial.print("Device added: ");
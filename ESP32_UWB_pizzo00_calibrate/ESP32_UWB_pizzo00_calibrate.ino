@@ -0,0 +1,185 @@
+// Antenna delay calibration of all the modules in one session (pizzo00 library)
+// Replaces the one anchor at a time binary search of ESP32_anchor_autocalibrate.
+//
+// Place the modules at accurately measured positions (module_matrix) and run
+// ESP32_UWB_pizzo00_anchor on all of them but this one, which is part of the set too.
+// 1) 's' here and on every anchor: each module ranges with all the others (DW1000Ranging.startSurvey())
+// 2) paste the "D address, delay" and "S from, to, range" lines printed by the anchors into
+//    this serial monitor, the D line gives the delay the anchor ranged with (kept in its flash)
+// 3) 'c' solves for all the antenna delays at once (least squares, DW1000Calibration),
+//    prints the residuals and broadcasts the new delays to the modules
+//
+// The anchors only accept the delays from their calibratorAddress, set it to shortAddress below.
+//
+// At least 3 modules, every module ranged with at least 2 others.
+
+#include <SPI.h>
+#include "DW1000Ranging.h"
+#include "DW1000.h"
+#include "DW1000Calibration.h"
+
+#define SPI_SCK 18
+#define SPI_MISO 19
+#define SPI_MOSI 23
+#define DW_CS 4
+
+// connection pins
+const uint8_t PIN_RST = 27; // reset pin
+const uint8_t PIN_IRQ = 34; // irq pin
+const uint8_t PIN_SS = 4;   // spi select pin
+
+uint16_t shortAddress = 128; //80:00
+const char *macAddress = "5B:D5:A9:9A:E2:90";
+
+#define N_MODULES 5
+// short addresses, antenna delays (until a D line reports the actual one) and measured positions [m]
+uint16_t module_addresses[N_MODULES] = {0x80, 0x81, 0x82, 0x83, 0x84};
+uint16_t module_Adelay[N_MODULES] = {16550, 16630, 16610, 16607, 16580};
+float module_matrix[N_MODULES][3] = {
+  {0.0, 0.0, 0.0},
+  {7.19, 0.0, 0.0},
+  {0.0, 7.19, 0.0},
+  {7.19, 7.19, 0.0},
+  {3.6, 3.6, 1.5}
+};
+
+// broadcasts of the result, there is no acknowledge
+#define N_BROADCASTS 5
+
+// NOTE: Any change on this parameters will affect the transmission time of the packets
+// So if you change this parameters you should also change the response times on the DW1000 library
+// (actual response times are based on experience made with these parameters)
+static constexpr byte MY_MODE[] = {DW1000.TRX_RATE_6800KBPS, DW1000.TX_PULSE_FREQ_16MHZ, DW1000.TX_PREAMBLE_LEN_64};
+
+DW1000Calibration calibration;
+uint16_t new_Adelay[N_MODULES];
+int broadcasts_left = 0;
+uint32_t last_broadcast = 0;
+char line[40];
+int line_length = 0;
+
+void setup()
+{
+  Serial.begin(115200);
+  delay(1000);
+
+  calibration.setModuleCount(N_MODULES);
+  for (int i = 0; i < N_MODULES; i++) {
+    calibration.setModule(i, module_addresses[i], module_Adelay[i]);
+  }
+  calibration.setKnownPositions(module_matrix);
+
+  //init the configuration
+  SPI.begin(SPI_SCK, SPI_MISO, SPI_MOSI);
+  DW1000Ranging.init(BoardType::ANCHOR, shortAddress, macAddress, false, MY_MODE, PIN_RST, PIN_SS, PIN_IRQ);
+  int own = calibration.getModuleIndex(shortAddress);
+  if (own >= 0) DW1000.setAntennaDelay(module_Adelay[own]);
+
+  DW1000Ranging.attachSurveyDone(surveyDone);
+  DW1000Ranging.attachAntennaDelay(newAntennaDelay);
+  Serial.println("'s' range with the other modules, paste their S lines, 'c' calibrate");
+}
+
+void loop()
+{
+  DW1000Ranging.loop();
+
+  if (broadcasts_left > 0 && !DW1000Ranging.isSurveying() && millis() - last_broadcast > 200) {
+    DW1000Ranging.transmitAntennaDelays(module_addresses, new_Adelay, N_MODULES);
+    last_broadcast = millis();
+    broadcasts_left--;
+  }
+
+  while (Serial.available()) {
+    char c = Serial.read();
+    if (c == '\n' || c == '\r') {
+      line[line_length] = 0;
+      if (line_length == 1 && line[0] == 's') DW1000Ranging.startSurvey();
+      else if (line_length == 1 && line[0] == 'c') calibrate();
+      else if (line_length > 2 && line[0] == 'S') addLine(line + 1);
+      else if (line_length > 2 && line[0] == 'D') addDelayLine(line + 1);
+      line_length = 0;
+    }
+    else if (line_length < (int)sizeof(line) - 1) line[line_length++] = c;
+  }
+}
+
+// "from, to, range" with the addresses in hex, as printed by ESP32_UWB_pizzo00_anchor
+void addLine(char *text)
+{
+  char *end;
+  uint16_t from = strtoul(text, &end, 16);
+  uint16_t to = strtoul(end + 1, &end, 16);
+  float range = strtod(end + 1, &end);
+  addRange(from, to, range);
+}
+
+// "address, delay" with the address in hex, as printed by ESP32_UWB_pizzo00_anchor
+void addDelayLine(char *text)
+{
+  char *end;
+  uint16_t address = strtoul(text, &end, 16);
+  uint16_t Adelay = strtoul(end + 1, &end, 10);
+  addDelay(address, Adelay);
+}
+
+void addDelay(uint16_t address, uint16_t Adelay)
+{
+  int i = calibration.getModuleIndex(address);
+  if (i < 0) {
+    Serial.print("Unknown module ");
+    Serial.println(address, HEX);
+    return;
+  }
+  module_Adelay[i] = Adelay;
+  calibration.setModule(i, address, Adelay);
+}
+
+void addRange(uint16_t from, uint16_t to, float range)
+{
+  int i = calibration.getModuleIndex(from);
+  int j = calibration.getModuleIndex(to);
+  if (i < 0 || j < 0) {
+    Serial.print("Unknown module ");
+    Serial.println(i < 0 ? from : to, HEX);
+    return;
+  }
+  calibration.addRange(i, j, range);
+}
+
+void surveyDone(const uint16_t addresses[], const float ranges[], uint8_t count)
+{
+  addDelay(shortAddress, DW1000.getAntennaDelay());
+  for (int i = 0; i < count; i++) addRange(shortAddress, addresses[i], ranges[i]);
+  Serial.print("Own ranges added: ");
+  Serial.println(count);
+}
+
+void calibrate()
+{
+  if (!calibration.solve()) {
+    Serial.println("***Not enough module pairs, range again***");
+    return;
+  }
+  Serial.println("module, Adelay, new Adelay, rms residual [m]");
+  for (int i = 0; i < N_MODULES; i++) {
+    new_Adelay[i] = calibration.getAntennaDelay(i);
+    Serial.print(module_addresses[i], HEX);
+    Serial.print(", ");
+    Serial.print(module_Adelay[i]);
+    Serial.print(", ");
+    Serial.print(new_Adelay[i]);
+    Serial.print(", ");
+    Serial.println(calibration.getModuleResidual(i), 3);
+  }
+  Serial.print("rms residual [m] ");
+  Serial.println(calibration.getResidual(), 3);
+  broadcasts_left = N_BROADCASTS;
+}
+
+void newAntennaDelay(uint16_t Adelay)
+{
+  addDelay(shortAddress, Adelay);
+  Serial.print("Antenna delay set ");
+  Serial.println(Adelay);
+}
@@ -5,6 +5,7 @@
 #include <SPI.h>
 #include "DW1000Ranging.h"
 #include "DW1000.h"
+#include "DW1000Locator.h"
 
 #define SPI_SCK 18
 #define SPI_MISO 19
@@ -25,6 +26,10 @@ const char *macAddress = "22:EA:82:60:3B:9C";
 // (actual response times are based on experience made with these parameters)
 static constexpr byte MY_MODE[] = {DW1000.TRX_RATE_6800KBPS, DW1000.TX_PULSE_FREQ_16MHZ, DW1000.TX_PREAMBLE_LEN_64};
 
+// anchors and their coordinates as advertised in their RANGING_INIT, any short address
+DW1000Locator locator;
+float current_tag_position[3] = {0};
+
 void setup()
 {
   Serial.begin(115200);
@@ -49,16 +54,41 @@ void newRange(DW1000Device *device)
   Serial.print(device->getShortAddress(), HEX);
   Serial.print(",");
   Serial.println(device->getRange());
+
+  // the anchor may have been surveyed again since its RANGING_INIT
+  locator.setAnchor(device);
+  locator.setRange(device->getShortAddress(), device->getRange());
+  if (locator.solve(current_tag_position)) {
+    Serial.print("P= ");
+    Serial.print(current_tag_position[0]);
+    Serial.write(',');
+    Serial.print(current_tag_position[1]);
+    Serial.write(',');
+    Serial.print(current_tag_position[2]);
+    Serial.write(',');
+    Serial.println(locator.getResidual());
+
+    // large sites: only the anchors of the active zone and its neighbours are polled
+    uint8_t zone = locator.predictZone(DW1000Ranging.getZone());
+    if (zone != DW1000Ranging.getZone()) {
+      Serial.print("Zone ");
+      Serial.println(zone);
+      DW1000Ranging.handOver(zone);
+    }
+  }
 }
 
 void newDevice(DW1000Device *device)
 {
   Serial.print("Device added: ");
-  Serial.println(device->getShortAddress(), HEX);
+  Serial.print(device->getShortAddress(), HEX);
+  if (locator.setAnchor(device)) Serial.print(" with coordinates");
+  Serial.println();
 }
 
 void inactiveDevice(DW1000Device *device)
 {
   Serial.print("delete inactive device: ");
   Serial.println(device->getShortAddress(), HEX);
+  locator.removeAnchor(device->getShortAddress());
 }
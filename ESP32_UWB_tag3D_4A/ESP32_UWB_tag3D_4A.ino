@@ -109,15 +109,16 @@ void newRange()
     }
 #endif
 
-    trilat3D_4A();
-    Serial.print("P= ");  //result
-    Serial.print(current_tag_position[0]);
-    Serial.write(',');
-    Serial.print(current_tag_position[1]);
-    Serial.write(',');
-    Serial.print(current_tag_position[2]);
-    Serial.write(',');
-    Serial.println(current_distance_rmse);
+    if (trilat3D_4A()) {
+      Serial.print("P= ");  //result
+      Serial.print(current_tag_position[0]);
+      Serial.write(',');
+      Serial.print(current_tag_position[1]);
+      Serial.write(',');
+      Serial.print(current_tag_position[2]);
+      Serial.write(',');
+      Serial.println(current_distance_rmse);
+    }
   }
 }  //end newRange
 
@@ -143,11 +144,13 @@ int trilat3D_4A(void) {
   // and needs to be inverted only once. Hence, the position calculation should be robust.
   //
   static bool first = true;  //first time through, some preliminary work
+  static bool singular = false;  //anchor_matrix is fixed, so is a singular A matrix
   float b[3], d[N_ANCHORS]; //distances from anchors
 
   static float Ainv[3][3], k[N_ANCHORS]; //these are calculated only once
 
   int i;
+  if (singular) return 0;
   // copy distances to local storage
   for (i = 0; i < N_ANCHORS; i++) d[i] = last_anchor_distance[i];
 
@@ -191,7 +194,8 @@ int trilat3D_4A(void) {
 #endif
     if (fabs(det) < 1.0e-4) {  //TODO : define as parameter
       Serial.println("***Singular matrix, check anchor coordinates***");
-      while (1) delay(1); //hang
+      singular = true;  //reported once, no position until anchor_matrix is fixed
+      return 0;
     }
 
     det = 1.0 / det;
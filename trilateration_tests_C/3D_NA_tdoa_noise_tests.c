@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "m33v3.h"   //matrix and vector operations, loops unrolled.
+#include "Mersenne.h"  //random number generator
+#include "tdoa.h"  //closed form TDoA solver
+#define N_ANCHORS 6
+
+    MTRand Random;  //required object for MTRand
+
+// ToA (two-way ranging, least squares as in 3D_NA_noise_tests.c) versus TDoA (Chan closed form,
+// with and without Gauss-Newton refinement) on the same anchors and the same noise.
+// The same +/- 0.1 m rms noise is put on each distance (ToA) or each arrival time (TDoA).
+//
+// coordinates of at least four anchors.
+float anchor_matrix[N_ANCHORS][3]=
+{
+    {0., 0., 0.},  //origin anchor. coordinates are relative to this (arbitrary) point
+    {10., 0., 3.},
+    {0., 10., 5.},
+    {10., 10., 1.},
+    {5., 5., 2.},
+    {3., 3., 3.}
+};
+
+float r[3]={0.0};  //input test position
+float rc[3]={0.0};  //calculated result
+
+// Gaussian noise with mean zero, S.D. depends inversely on n
+float Gauss (int n) {
+    int i;
+    float t=0.0;
+    for(i=0; i<n; i++) {
+    t += genRand(&Random)-0.5;;
+    }
+    return t/n;
+}
+
+float ATAinv[3][3], A[N_ANCHORS-1][3], kv[N_ANCHORS];
+tdoa_layout layout;
+
+// ToA position from distances, see 3D_NA_noise_tests.c
+void toa_solve(float d[], float x[3]) {
+    int i,k;
+    float b[N_ANCHORS-1], ATb[3];
+    for (i=1; i<N_ANCHORS; i++) {
+    b[i-1] = d[0]*d[0] - d[i]*d[i] + kv[i] - kv[0];
+    }
+    for (i=0; i<3; i++) {
+    ATb[i]=0;
+    for (k=0; k<N_ANCHORS-1; k++) {
+        ATb[i] += A[k][i]*b[k];
+        }
+    }
+    MAT_DOT_VEC_3X3(x,ATAinv,ATb); //position scaled by 2
+    VEC_SCALE(x,0.5,x);
+}
+
+float error(float x[3]) {
+    float v[3], e;
+    VEC_DIFF(v,r,x);
+    VEC_LENGTH(e,v);
+    return e;
+}
+
+int main()
+{
+    int i,j,k,l;  //loop variables
+
+    int N_est = 3; //number of trial solutions per position
+    int N_trials = 20;  //number of generated position trials
+    int N_bench = 100000;  //solves timed for each method
+    Random = seedRand(1337);
+
+    float tmp, ATA[3][3], det;
+    float d[N_ANCHORS], rd[N_ANCHORS-1], x[N_ANCHORS];  //distances, range differences to anchor 0
+    float rc_toa[3], rc_tdoa[3], rc_chan[3];
+    float e_toa=0.0, e_tdoa=0.0, e_chan=0.0;  //mean position errors
+
+    printf("ToA vs TDoA 3D test: %d anchors, %d position trials, %d estimates each\n", N_ANCHORS, N_trials, N_est);
+
+    // ToA: ATAinv, depends on anchor configuration only
+    for (i=0; i<N_ANCHORS; i++) {
+    kv[i] = anchor_matrix[i][0]*anchor_matrix[i][0] + anchor_matrix[i][1]*anchor_matrix[i][1] + anchor_matrix[i][2]*anchor_matrix[i][2];
+    }
+    for (i=1; i<N_ANCHORS; i++) {
+    VEC_DIFF(A[i-1],anchor_matrix[i],anchor_matrix[0]);
+    }
+    for (i=0; i<3; i++) {
+        for (j=0; j<3; j++) {
+            ATA[i][j]=0.0;
+            for (k=0; k<N_ANCHORS-1; k++) {
+                ATA[i][j] += A[k][i]*A[k][j];
+            }
+        }
+    }
+    DETERMINANT_3X3 (det, ATA);
+    printf("ToA det = %8.3e\n",det);
+    det = 1.0 / (det);
+    SCALE_ADJOINT_3X3 (ATAinv, det, ATA);
+
+    // TDoA: pseudo-inverse, depends on anchor configuration only
+    if (!tdoa_setup(&layout, anchor_matrix, N_ANCHORS, 3)) {
+    printf("TDoA: degenerate anchor layout\n");
+    return 1;
+    }
+
+    printf("x, y, z, ToA err, TDoA closed form err, TDoA refined err\n");
+    for (j=1; j<=N_trials; j++) {
+
+// generate positions
+    r[0] = 10.0*genRand(&Random);
+    r[1] = 10.0*genRand(&Random);
+    r[2] =  3.0*genRand(&Random);
+    float et=0.0, ec=0.0, er=0.0;
+
+    for(l=0; l<N_est; l++) {
+
+    for(i=0; i<N_ANCHORS; i++) {
+    VEC_DIFF(x,anchor_matrix[i],r);  //reuse x vector
+    VEC_LENGTH(tmp, x);
+    d[i] = tmp + Gauss(7); //distance, or arrival time less the unknown emission time, with noise
+    }
+    for(i=1; i<N_ANCHORS; i++) rd[i-1] = d[i] - d[0];
+
+    toa_solve(d, rc_toa);
+    tdoa_solve(&layout, rd, rc_chan, 0);
+    tdoa_solve(&layout, rd, rc_tdoa, 3);
+    et += error(rc_toa);
+    ec += error(rc_chan);
+    er += error(rc_tdoa);
+    } // end for l (N_est)
+
+    printf("%6.2f, %6.2f, %6.2f, %6.3f, %6.3f, %6.3f\n", r[0],r[1],r[2], et/N_est, ec/N_est, er/N_est);
+    e_toa += et; e_chan += ec; e_tdoa += er;
+    }  // end for j
+
+    printf("mean position error: ToA %6.3f, TDoA closed form %6.3f, TDoA refined %6.3f\n",
+           e_toa/(N_trials*N_est), e_chan/(N_trials*N_est), e_tdoa/(N_trials*N_est));
+
+// throughput, the input moves a little and the sink keeps the optimizer from dropping the calls
+    volatile float sink = 0.0;
+    clock_t t0 = clock();
+    for (l=0; l<N_bench; l++) { d[0] += 1e-6; toa_solve(d, rc_toa); sink += rc_toa[0]; }
+    clock_t t1 = clock();
+    for (l=0; l<N_bench; l++) { rd[0] += 1e-6; tdoa_solve(&layout, rd, rc_chan, 0); sink += rc_chan[0]; }
+    clock_t t2 = clock();
+    for (l=0; l<N_bench; l++) { rd[0] += 1e-6; tdoa_solve(&layout, rd, rc_tdoa, 3); sink += rc_tdoa[0]; }
+    clock_t t3 = clock();
+    printf("us per solve: ToA %6.3f, TDoA closed form %6.3f, TDoA refined %6.3f\n",
+           1e6*(t1-t0)/CLOCKS_PER_SEC/N_bench, 1e6*(t2-t1)/CLOCKS_PER_SEC/N_bench, 1e6*(t3-t2)/CLOCKS_PER_SEC/N_bench);
+    return 0;
+}
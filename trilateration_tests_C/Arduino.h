@@ -0,0 +1,13 @@
+// Host stand-in for the Arduino types used by the DW1000 library headers, for the C++
+// harnesses here that build library code (e.g. config_tests.cpp)
+#ifndef ARDUINO_HOST_H
+#define ARDUINO_HOST_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#endif
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "DW1000Config.h"
+
+// Host test of the DW1000Config file backend: save -> load gives the same record back, and
+// load() rejects a corrupted byte, a wrong version and an oversized anchorCount.
+// Build from this folder:
+// g++ -I. -I../DW1000_library_pizzo00/src config_tests.cpp ../DW1000_library_pizzo00/src/DW1000Config.cpp
+//     ../DW1000_library_pizzo00/src/DW1000Tdoa.cpp ../DW1000_library_pizzo00/src/DW1000Time.cpp -o config_tests
+
+#define TEST_FILE "config_tests.cfg"
+
+int failures = 0;
+
+void check(bool ok, const char *test)
+{
+    printf("%s: %s\n", ok ? "PASS" : "FAIL", test);
+    if (!ok) failures++;
+}
+
+// CRC-32 as in DW1000Config, for records made valid except for the field under test
+uint32_t crc32(const DW1000ConfigRecord &record)
+{
+    const byte *data = (const byte *)&record;
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < offsetof(DW1000ConfigRecord, checksum); i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+bool readRecord(DW1000ConfigRecord &record)
+{
+    FILE *file = fopen(TEST_FILE, "rb");
+    if (file == NULL) return false;
+    size_t length = fread(&record, 1, sizeof(record), file);
+    fclose(file);
+    return length == sizeof(record);
+}
+
+bool writeRecord(const DW1000ConfigRecord &record)
+{
+    FILE *file = fopen(TEST_FILE, "wb");
+    if (file == NULL) return false;
+    size_t length = fwrite(&record, 1, sizeof(record), file);
+    return fclose(file) == 0 && length == sizeof(record);
+}
+
+// load() of the test file must fail and keep the defaults
+bool rejected()
+{
+    DW1000Config config;
+    config.setFile(TEST_FILE);
+    return !config.load() && config.getAntennaDelay() == 16384 && config.getAnchorCount() == 0;
+}
+
+int main()
+{
+    const uint16_t addresses[4] = {0x81, 0x82, 0x83, 0x84};
+    const float anchors[4][3] = {
+        {0., 0., 0.},
+        {10., 0., 1.},
+        {0., 10., 0.},
+        {10., 10., 2.}
+    };
+    const byte mode[3] = {2, 1, 4};
+
+    DW1000Config saved;
+    saved.setFile(TEST_FILE);
+    saved.setBoardType(1);
+    saved.setShortAddress(0x84);
+    saved.setAntennaDelay(16580);
+    saved.setMode(mode);
+    check(saved.setAnchors(addresses, anchors, 4), "solver of the anchors");
+    check(saved.save(), "save");
+
+    DW1000Config loaded;
+    loaded.setFile(TEST_FILE);
+    check(loaded.load(), "load");
+    check(memcmp(&loaded.getRecord(), &saved.getRecord(), sizeof(DW1000ConfigRecord)) == 0, "loaded record equals saved record");
+
+    DW1000ConfigRecord good, record;
+    check(readRecord(good), "read back the file");
+
+    record = good;
+    ((byte *)&record)[offsetof(DW1000ConfigRecord, antennaDelay)] ^= 0x01;
+    check(writeRecord(record) && rejected(), "corrupted byte rejected");
+
+    record = good;
+    record.version++;
+    record.checksum = crc32(record);
+    check(writeRecord(record) && rejected(), "wrong version rejected");
+
+    record = good;
+    record.anchorCount = CONFIG_MAX_ANCHORS + 1;
+    record.checksum = crc32(record);
+    check(writeRecord(record) && rejected(), "oversized anchorCount rejected");
+
+    record = good;
+    check(writeRecord(record) && !rejected(), "unchanged record still loads");
+
+    remove(TEST_FILE);
+    printf("%d failures\n", failures);
+    return failures != 0;
+}
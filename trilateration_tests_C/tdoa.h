@@ -0,0 +1,173 @@
+/*
+ * tdoa.h
+ *
+ * Closed form TDoA position solver (Chan) for N anchors, 2D or 3D.
+ *
+ * Range differences r_i = d_i - d_0 to anchor 0 give the linear system
+ *    2 (s_i - s_0) x = |s_i|^2 - |s_0|^2 - r_i^2 - 2 r_i d_0,   i = 1..N-1
+ * so x = a + b d_0 with the pseudo-inverse P = (A^T A)^-1 A^T of A_i = 2 (s_i - s_0).
+ * P depends only on the anchor layout (like ATAinv of the ToA code) and is computed once.
+ * |x - s_0| = d_0 is then a quadratic in d_0, and a few Gauss-Newton steps on the
+ * range differences can refine the closed form solution.
+ */
+
+#ifndef TDOA_H
+#define TDOA_H
+
+#include <math.h>
+#include <string.h>
+
+#define TDOA_MAX_ANCHORS 16
+
+typedef struct {
+    int n, dim;
+    float s[TDOA_MAX_ANCHORS][3];  //anchor coordinates
+    float K[TDOA_MAX_ANCHORS];     //|s_i|^2
+    float P[3][TDOA_MAX_ANCHORS-1];  //(A^T A)^-1 A^T
+} tdoa_layout;
+
+// in place inverse of a n x n matrix (n <= 3), returns 0 if singular
+static int tdoa_invert(float m[3][3], int n) {
+    float inv[3][3] = {{1,0,0},{0,1,0},{0,0,1}};
+    int i, j, k;
+    for (j=0; j<n; j++) {
+        int p = j;
+        for (i=j+1; i<n; i++) if (fabs(m[i][j]) > fabs(m[p][j])) p = i;
+        if (fabs(m[p][j]) < 1e-9) return 0;
+        for (k=0; k<n; k++) {
+            float t = m[j][k]; m[j][k] = m[p][k]; m[p][k] = t;
+            t = inv[j][k]; inv[j][k] = inv[p][k]; inv[p][k] = t;
+        }
+        float sc = 1.0/m[j][j];
+        for (k=0; k<n; k++) { m[j][k] *= sc; inv[j][k] *= sc; }
+        for (i=0; i<n; i++) {
+            if (i == j) continue;
+            float f = m[i][j];
+            for (k=0; k<n; k++) { m[i][k] -= f*m[j][k]; inv[i][k] -= f*inv[j][k]; }
+        }
+    }
+    memcpy(m, inv, sizeof(inv));
+    return 1;
+}
+
+// precompute for the anchor layout, anchor 0 is the reference. Returns 0 if degenerate
+static int tdoa_setup(tdoa_layout *L, float anchors[][3], int n, int dim) {
+    int i, j, k;
+    float A[TDOA_MAX_ANCHORS-1][3], ATA[3][3];
+    if (n > TDOA_MAX_ANCHORS || n < dim+1 || dim < 2 || dim > 3) return 0;
+    L->n = n;
+    L->dim = dim;
+    for (i=0; i<n; i++) {
+        L->K[i] = 0.0;
+        for (k=0; k<3; k++) {
+            L->s[i][k] = (k < dim)? anchors[i][k] : 0.0;
+            L->K[i] += L->s[i][k]*L->s[i][k];
+        }
+    }
+    for (i=1; i<n; i++)
+        for (k=0; k<dim; k++) A[i-1][k] = 2.0*(L->s[i][k] - L->s[0][k]);
+
+    for (j=0; j<dim; j++)
+        for (k=0; k<dim; k++) {
+            ATA[j][k] = 0.0;
+            for (i=0; i<n-1; i++) ATA[j][k] += A[i][j]*A[i][k];
+        }
+    if (!tdoa_invert(ATA, dim)) return 0;
+
+    for (j=0; j<dim; j++)
+        for (i=0; i<n-1; i++) {
+            L->P[j][i] = 0.0;
+            for (k=0; k<dim; k++) L->P[j][i] += ATA[j][k]*A[i][k];
+        }
+    return 1;
+}
+
+// rms residual of the range differences at position x
+static float tdoa_residual(tdoa_layout *L, float r[], float x[3]) {
+    int i, k;
+    float d[TDOA_MAX_ANCHORS], sum = 0.0;
+    for (i=0; i<L->n; i++) {
+        float t = 0.0;
+        for (k=0; k<L->dim; k++) t += (x[k]-L->s[i][k])*(x[k]-L->s[i][k]);
+        d[i] = sqrt(t);
+    }
+    for (i=1; i<L->n; i++) {
+        float f = d[i] - d[0] - r[i-1];
+        sum += f*f;
+    }
+    return sqrt(sum/(L->n-1));
+}
+
+// one Gauss-Newton step on f_i = |x - s_i| - |x - s_0| - r_i
+static void tdoa_refine(tdoa_layout *L, float r[], float x[3]) {
+    int i, j, k, dim = L->dim;
+    float u0[3], d0 = 0.0, JTJ[3][3] = {{0}}, JTf[3] = {0};
+    for (k=0; k<dim; k++) d0 += (x[k]-L->s[0][k])*(x[k]-L->s[0][k]);
+    d0 = sqrt(d0);
+    if (d0 < 1e-6) return;
+    for (k=0; k<dim; k++) u0[k] = (x[k]-L->s[0][k])/d0;
+    for (i=1; i<L->n; i++) {
+        float J[3], di = 0.0;
+        for (k=0; k<dim; k++) di += (x[k]-L->s[i][k])*(x[k]-L->s[i][k]);
+        di = sqrt(di);
+        if (di < 1e-6) return;
+        for (k=0; k<dim; k++) J[k] = (x[k]-L->s[i][k])/di - u0[k];
+        float f = di - d0 - r[i-1];
+        for (j=0; j<dim; j++) {
+            JTf[j] += J[j]*f;
+            for (k=0; k<dim; k++) JTJ[j][k] += J[j]*J[k];
+        }
+    }
+    if (!tdoa_invert(JTJ, dim)) return;
+    for (j=0; j<dim; j++)
+        for (k=0; k<dim; k++) x[j] -= JTJ[j][k]*JTf[k];
+}
+
+// r[0..n-2]: range differences d_i - d_0. Returns 0 if there is no solution
+static int tdoa_solve(tdoa_layout *L, float r[], float x[3], int refine) {
+    int i, j, k, dim = L->dim, nroots = 0;
+    float a[3] = {0}, b[3] = {0}, u[3], roots[2];
+    float qa = -1.0, qb = 0.0, qc = 0.0;
+
+    for (i=1; i<L->n; i++) {
+        float c = L->K[i] - L->K[0] - r[i-1]*r[i-1];
+        for (k=0; k<dim; k++) {
+            a[k] += L->P[k][i-1]*c;
+            b[k] -= L->P[k][i-1]*2.0*r[i-1];
+        }
+    }
+    // |a + b d0 - s_0|^2 = d0^2
+    for (k=0; k<dim; k++) {
+        u[k] = a[k] - L->s[0][k];
+        qa += b[k]*b[k];
+        qb += 2.0*u[k]*b[k];
+        qc += u[k]*u[k];
+    }
+    if (fabs(qa) < 1e-6) {
+        if (qb != 0.0) roots[nroots++] = -qc/qb;
+    } else {
+        float disc = qb*qb - 4.0*qa*qc;
+        if (disc >= 0.0) {
+            roots[nroots++] = (-qb + sqrt(disc))/(2.0*qa);
+            roots[nroots++] = (-qb - sqrt(disc))/(2.0*qa);
+        } else roots[nroots++] = -qb/(2.0*qa);  //noise: closest point to the constraint
+    }
+
+    // keep the root with the smallest residual
+    float best = -1.0, best_res = 0.0;
+    for (j=0; j<nroots; j++) {
+        float d0 = (roots[j] > 0.0)? roots[j] : 0.0;
+        float xc[3] = {0};
+        for (k=0; k<dim; k++) xc[k] = a[k] + b[k]*d0;
+        float res = tdoa_residual(L, r, xc);
+        if (best < 0.0 || res < best_res) { best = d0; best_res = res; }
+    }
+    if (best < 0.0) return 0;
+
+    x[0] = x[1] = x[2] = 0.0;
+    for (k=0; k<dim; k++) x[k] = a[k] + b[k]*best;
+    for (j=0; j<refine; j++) tdoa_refine(L, r, x);
+    return 1;
+}
+
+#endif
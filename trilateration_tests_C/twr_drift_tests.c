@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "Mersenne.h"  //random number generator
+
+// Simulation of the two-way ranging schemes of DW1000Ranging with drifting clocks:
+// asymmetric DS-TWR (POLL / POLL_ACK / RANGE) versus SS-TWR (POLL / POLL_ACK) without
+// and with the clock offset correction from the carrier integrator.
+// Errors are printed for each POLL_ACK slot, as the reply time grows with the slot.
+
+#define C_AIR 299702547.0  //m/s
+#define N_SLOTS 4
+
+    MTRand Random;  //required object for MTRand
+
+double reply_delay = 3000e-6;  //s, DEFAULT_REPLY_DELAY_TIME, one POLL_ACK slot
+double crystal_ppm = 10.0;     //max clock error of each board, uniform +/-
+double stamp_noise = 0.1e-9;   //s, rms noise of one RX/TX timestamp (~3 cm)
+double offset_noise = 0.2e-6;  //rms error of the carrier integrator clock offset estimate
+
+// Gaussian noise with mean zero and unit S.D.
+double Gauss (int n) {
+    int i;
+    double t=0.0;
+    for(i=0; i<n; i++) {
+    t += genRand(&Random)-0.5;
+    }
+    return t*sqrt(12.0/n);
+}
+
+// a timestamp taken by a clock running (1+e) times the true rate
+double stamp(double t, double e) {
+    return t*(1.0+e) + stamp_noise*Gauss(7);
+}
+
+int main()
+{
+    int i,j;  //loop variables
+    int N_trials = 10000;  //exchanges per slot
+    Random = seedRand(1337);
+
+    printf("TWR drift test: +/-%4.1f ppm crystals, %4.2f ns timestamp noise, %4.2f ppm offset noise\n",
+           crystal_ppm, stamp_noise*1e9, offset_noise*1e6);
+    printf("slot, reply [us], DS mean, DS sd, SS mean, SS sd, SS corrected mean, SS corrected sd (cm)\n");
+
+    for (i=0; i<N_SLOTS; i++) {
+
+    double db1 = (i+1)*reply_delay;  //anchor reply to POLL, true time
+    double db2 = N_SLOTS*reply_delay - db1 + reply_delay;  //tag reply to POLL_ACK, after the last slot
+    double err[3]={0}, err2[3]={0};
+
+    for (j=0; j<N_trials; j++) {
+    double d = 1.0 + 29.0*genRand(&Random);
+    double tof = d/C_AIR;
+    double et = crystal_ppm*1e-6*(2.0*genRand(&Random)-1.0);  //tag clock
+    double ea = crystal_ppm*1e-6*(2.0*genRand(&Random)-1.0);  //anchor clock
+    double t0 = 1.0*genRand(&Random);  //arbitrary start
+
+    // true event times
+    double poll_tx = t0;
+    double poll_rx = poll_tx + tof;
+    double ack_tx = poll_rx + db1;
+    double ack_rx = ack_tx + tof;
+    double range_tx = ack_rx + db2;
+    double range_rx = range_tx + tof;
+
+    // what each board sees. The delayed TX times are exact, the RX times noisy
+    double round1 = stamp(ack_rx, et) - poll_tx*(1.0+et);
+    double reply1 = ack_tx*(1.0+ea) - stamp(poll_rx, ea);
+    double round2 = stamp(range_rx, ea) - ack_tx*(1.0+ea);
+    double reply2 = range_tx*(1.0+et) - stamp(ack_rx, et);
+
+    // DS-TWR, computeRangeAsymmetric()
+    double ds = (round1*round2 - reply1*reply2)/(round1 + round2 + reply1 + reply2);
+
+    // SS-TWR, computeRangeSingleSided() with no and with the measured clock offset
+    double offset = (1.0+ea)/(1.0+et) - 1.0;
+    double ss = (round1 - reply1)/2.0;
+    double ssc = (round1 - reply1*(1.0 - (offset + offset_noise*Gauss(7))))/2.0;
+
+    double e[3];
+    e[0] = ds*C_AIR - d;
+    e[1] = ss*C_AIR - d;
+    e[2] = ssc*C_AIR - d;
+    int k;
+    for (k=0; k<3; k++) {
+    err[k] += e[k];
+    err2[k] += e[k]*e[k];
+    }
+    }  // end for j
+
+    printf("%d, %6.0f", i, db1*1e6);
+    int k;
+    for (k=0; k<3; k++) {
+    double mean = err[k]/N_trials;
+    double sd = sqrt(err2[k]/N_trials - mean*mean);
+    printf(", %8.2f, %8.2f", 100.0*mean, 100.0*sd);
+    }
+    printf("\n");
+    }  // end for i
+    return 0;
+}